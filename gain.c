@@ -0,0 +1,211 @@
+/****************************************************************************
+**
+** gain.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/****************************************************************************/
+/*                                                                          */
+/* SOURCE FILE NAME:  GAIN.C                                                */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  OUTPUT GAIN                                           */
+/*                                                                          */
+/* FUNCTION:  This file contains routines to apply the volume of the        */
+/*            instance to the decoded samples.  Samples are scaled in       */
+/*            float, and converted back to 16 bits once with TPDF dither,   */
+/*            instead of letting KAI scale them in integer.  Channels       */
+/*            turned off are scaled by 0 in the same pass.                  */
+/*                                                                          */
+/* ENTRY POINTS:                                                            */
+/*       GainSetVolume() - Set the volume of channels                       */
+/*       GainSetAudio() - Turn on or off channels                           */
+/*       GainApply() - Apply the volume to samples                          */
+/****************************************************************************/
+#define INCL_BASE                    // Base OS2 functions
+#define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
+
+#include <os2.h>                     // OS2 defines.
+#include <string.h>                  // C string functions
+#include <os2me.h>                   // MME includes files.
+#include <stdlib.h>                  // Math functions
+#include "mcdtemp.h"                 // Function Prototypes.
+
+/* frames to ramp the gain over when the volume changes */
+#define GAIN_RAMP_FRAMES    256
+
+/* uniform random number in [0, 1) LSB */
+static inline float ditherRand(PULONG pulSeed)
+{
+    *pulSeed = *pulSeed * 1664525 + 1013904223;
+
+    return ((*pulSeed >> 8) & 0xFFFFFF) * (1.0f / (1 << 24));
+}
+
+/* ramp the gain linearly over frames, return the next seed */
+static ULONG gainRamp(PSHORT ps, ULONG ulFrames, ULONG ulChannels,
+                      const float *from, const float *to, ULONG ulSeed)
+{
+    for (ULONG i = 0; i < ulFrames; i++)
+    {
+        float t = (float)(i + 1) / ulFrames;
+
+        for (ULONG c = 0; c < ulChannels; c++)
+        {
+            float f = *ps * (from[c] + (to[c] - from[c]) * t) +
+                      ditherRand(&ulSeed) - ditherRand(&ulSeed);
+
+            /* round to nearest */
+            f += f < 0 ? -0.5f : 0.5f;
+
+            if (f > 32767.0f)
+                f = 32767.0f;
+            else if (f < -32768.0f)
+                f = -32768.0f;
+
+            *ps++ = (SHORT)f;
+        }
+    }
+
+    return ulSeed;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GainSetVolume                                          */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Set the volume of channels                            */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance -- Pointer to instance.                        */
+/*      ULONG      ulAudio   -- MCI_SET_AUDIO_ALL, _LEFT or _RIGHT.         */
+/*      ULONG      ulLevel   -- Volume in percentage.                       */
+/*                                                                          */
+/****************************************************************************/
+VOID GainSetVolume(PINSTANCE pInstance, ULONG ulAudio, ULONG ulLevel)
+{
+    if (ulLevel > 100)
+        ulLevel = 100;
+
+    if (ulAudio != MCI_SET_AUDIO_RIGHT)
+        pInstance->aulVolume[0] = ulLevel;
+
+    if (ulAudio != MCI_SET_AUDIO_LEFT)
+        pInstance->aulVolume[1] = ulLevel;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GainSetAudio                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Turn on or off channels                               */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance -- Pointer to instance.                        */
+/*      ULONG      ulAudio   -- MCI_SET_AUDIO_ALL, _LEFT or _RIGHT.         */
+/*      BOOL       fOn       -- TRUE to turn on, FALSE to turn off.         */
+/*                                                                          */
+/****************************************************************************/
+VOID GainSetAudio(PINSTANCE pInstance, ULONG ulAudio, BOOL fOn)
+{
+    if (ulAudio != MCI_SET_AUDIO_RIGHT)
+        pInstance->AudioOn[0] = fOn;
+
+    if (ulAudio != MCI_SET_AUDIO_LEFT)
+        pInstance->AudioOn[1] = fOn;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GainApply                                              */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Apply the volume to samples                           */
+/*                                                                          */
+/* FUNCTION:  Scale 16-bit samples by the volume of their channel, and      */
+/*            round them to 16 bits with TPDF dither.  Nothing is done at   */
+/*            full volume, and silence is filled if all channels are off.   */
+/*            When the volume has changed, the gain is ramped linearly from */
+/*            the previous one over the first GAIN_RAMP_FRAMES frames to    */
+/*            avoid a click.                                                */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance -- Pointer to instance.                        */
+/*      PVOID      pBuffer   -- Samples.                                    */
+/*      ULONG      ulSize    -- Size of pBuffer in bytes.                   */
+/*                                                                          */
+/****************************************************************************/
+VOID GainApply(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize)
+{
+    PSHORT ps = pBuffer;
+    ULONG ulChannels = pInstance->ai.channels;
+    ULONG ulSamples = ulSize / sizeof(SHORT);
+    ULONG ulSeed = pInstance->ulDitherSeed;
+    float gain[2];
+
+    gain[0] = pInstance->AudioOn[0] ? pInstance->aulVolume[0] / 100.0f : 0;
+    gain[1] = ulChannels == 1 ? gain[0] :
+              pInstance->AudioOn[1] ? pInstance->aulVolume[1] / 100.0f : 0;
+
+    if (gain[0] != pInstance->afGain[0] || gain[1] != pInstance->afGain[1])
+    {
+        ULONG ulFrames = ulSamples / ulChannels;
+
+        if (ulFrames > GAIN_RAMP_FRAMES)
+            ulFrames = GAIN_RAMP_FRAMES;
+
+        ulSeed = gainRamp(ps, ulFrames, ulChannels, pInstance->afGain, gain,
+                          ulSeed);
+
+        pInstance->afGain[0] = gain[0];
+        pInstance->afGain[1] = gain[1];
+        pInstance->ulDitherSeed = ulSeed;
+
+        ps += ulFrames * ulChannels;
+        ulSamples -= ulFrames * ulChannels;
+        ulSize = ulSamples * sizeof(SHORT);
+        pBuffer = ps;
+    }
+
+    if (gain[0] == 1.0f && gain[1] == 1.0f)
+        return;
+
+    if (gain[0] == 0 && gain[1] == 0)
+    {
+        memset(pBuffer, 0, ulSize);
+        return;
+    }
+
+    for (ULONG i = 0; i < ulSamples; i++)
+    {
+        float f = ps[i] * gain[i & (ulChannels - 1)] +
+                  ditherRand(&ulSeed) - ditherRand(&ulSeed);
+
+        /* round to nearest */
+        f += f < 0 ? -0.5f : 0.5f;
+
+        if (f > 32767.0f)
+            f = 32767.0f;
+        else if (f < -32768.0f)
+            f = -32768.0f;
+
+        ps[i] = (SHORT)f;
+    }
+
+    pInstance->ulDitherSeed = ulSeed;
+}
@@ -41,9 +41,15 @@ struct PTRINFO
 void *malloc(size_t size)
 {
     struct PTRINFO *p;
+    void *magic;
 
     if (size < MIN_OF_DOSALLOCMEM)
+    {
         p = _hmalloc(size + sizeof(*p));
+        magic = _hmalloc;
+    }
+    else if ((p = smplmemAlloc(sizeof(*p), size)))
+        magic = smplmemAlloc;   /* sample data of SoundFont */
     else
     {
         if (DosAllocMem((PPVOID)&p, size + sizeof(*p),
@@ -51,12 +57,13 @@ void *malloc(size_t size)
             p = NULL;
 
         LOG_MSG(2, "DosAllocMem(%d) = %p", size, p + 1);
+
+        magic = DosAllocMem;
     }
 
     if (p)
     {
-        p->magic = size < MIN_OF_DOSALLOCMEM ?
-                        (void *)_hmalloc : (void *)DosAllocMem;
+        p->magic = magic;
         p->size = size;
 
         return p + 1;
@@ -93,10 +100,12 @@ void *realloc(void *mem, size_t size)
     p--;
 
     /*
-     * If memory block was not allocated by _hmalloc() nor DosAllocMem(),
-     * use _std_realloc() because it's not possible to know size of mem.
+     * If memory block was not allocated by _hmalloc(), DosAllocMem() nor
+     * smplmemAlloc(), use _std_realloc() because it's not possible to know
+     * size of mem.
      */
-    if (p->magic != _hmalloc && p->magic != DosAllocMem)
+    if (p->magic != _hmalloc && p->magic != DosAllocMem &&
+        p->magic != smplmemAlloc)
         return _std_realloc(mem, size);
 
     void *newMem = malloc(size);
@@ -132,6 +141,8 @@ void free(void *mem)
 
         LOG_MSG(2, "DosFreeMem(%p, %d) = %ld", mem, size, DosFreeMem(p));
     }
+    else if (p->magic == smplmemAlloc)
+        smplmemFree(p);
     else
         _std_free(mem);
 }
@@ -103,6 +103,7 @@ RC MCICaps(FUNCTION_PARM_BLOCK *pFuncBlock)
             {
                 /* supported messages */
                 case MCI_CLOSE:
+                case MCI_CUE:
                 case MCI_GETDEVCAPS:
                 case MCI_INFO:
                 case MCI_LOAD:
@@ -123,7 +124,6 @@ RC MCICaps(FUNCTION_PARM_BLOCK *pFuncBlock)
                 /* unsupported messages */
                 case MCI_ACQUIREDEVICE:
                 case MCI_CONNECTOR:
-                case MCI_CUE:
                 case MCI_DEVICESETTINGS:
                 case MCI_ESCAPE:
                 case MCI_GETTOC:
@@ -107,7 +107,13 @@ RC MCIClose (FUNCTION_PARM_BLOCK *pFuncBlock)
 
   pInstance->AvoidDeadLock = FALSE;
 
-  kmdecClose(pInstance->dec);
+  NotifyDone(pInstance);
+
+  RenderDone(pInstance);
+
+  CloseDecoder(pInstance);
+
+  FreeMidiInfo(&pInstance->smf);
 
   /***************************************************************/
   /* Send back a notification if the notify flag was on          */
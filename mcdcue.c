@@ -95,7 +95,7 @@ RC MCISetCuePoint(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCISETCUEPOINTVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
-    ULONG ulCuepoint = ConvertTime(pParam2->ulCuepoint, pInst->ulTimeFormat,
+    ULONG ulCuepoint = ConvertTime(pInst, pParam2->ulCuepoint, pInst->ulTimeFormat,
                                    MCI_FORMAT_MILLISECONDS);
 
     switch (ulParam1 & ~(MCI_WAIT | MCI_NOTIFY))
@@ -129,6 +129,8 @@ RC MCISetCuePoint(FUNCTION_PARM_BLOCK *pFuncBlock)
                     pInst->cueNotify[empty].ulCuepoint = ulCuepoint;
                     pInst->cueNotify[empty].usUserParm = pParam2->usUserParm;
                     pInst->cueNotify[empty].On = TRUE;
+
+                    NotifyWake(pInst);
                 }
             }
 
@@ -105,7 +105,11 @@ RC MCIDRVRestore (FUNCTION_PARM_BLOCK *pFuncBlock)
   QMAudio(pInstance);                                 // Get master audio settings
   if ((pInstance->ulSavedStatus & (KAIS_PLAYING | KAIS_PAUSED)) ==
       KAIS_PLAYING)
+     {
+     if (pInstance->Stamped)
+        StampPosition(pInstance, pInstance->ulStampPos);
      kaiResume(pInstance->hkai);
+     }
 
   /* clear ulSavedStatus for MCIDRV_RESTORE to an active instance */
   pInstance->ulSavedStatus = 0;
@@ -105,7 +105,10 @@ RC MCIDRVSave (FUNCTION_PARM_BLOCK *pFuncBlock)
   pInstance->ulSavedStatus = kaiStatus(pInstance->hkai);
   if ((pInstance->ulSavedStatus & (KAIS_PLAYING | KAIS_PAUSED)) ==
       KAIS_PLAYING)
+    {
+    StampPosition(pInstance, GetPosition(pInstance));
     kaiPause(pInstance->hkai);
+    }
   pInstance->Active = FALSE;
 
   /* make compiler happy */
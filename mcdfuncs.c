@@ -36,6 +36,12 @@
 /*       GetINIInstallName() - Get the MMPM/2 install name for this device  */
 /*       ConvertTime() - Convert time formats                               */
 /*       GetDeviceInfo() - Get device info                                  */
+/*       GetDevParam() - Get a configuration value                          */
+/*       GetDevParamULong() - Get a numeric configuration value             */
+/*       AudiblePosition() - Get the position being heard                   */
+/*       GetPosition() - Get the current position                           */
+/*       StampPosition() - Record the position heard now                    */
+/*       QueryTimerMs() - Query the high resolution timer                   */
 /****************************************************************************/
 #define INCL_BASE                    // Base OS2 functions
 #define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
@@ -46,6 +52,8 @@
 #include <os2me.h>                   // MME includes files.
 #include "mcdtemp.h"                 // MCD Function Prototypes and typedefs
 
+#include <stdio.h>                   // snprintf()
+
 
 /****************************************************************************/
 /*                                                                          */
@@ -200,59 +208,120 @@ VOID  GetDeviceInfo(PINSTANCE pInstance)
 
 
 
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  SmpteFps                                               */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Frames per second of a SMPTE time format.             */
+/*                                                                          */
+/* NOTES: 30 drop-frame is treated as 30 frames per second.                 */
+/*                                                                          */
+/****************************************************************************/
+static ULONG SmpteFps(ULONG ulFormat)
+{
+   switch (ulFormat)
+      {
+      case MCI_SEQ_SET_SMPTE_24:
+         return 24;
+      case MCI_SEQ_SET_SMPTE_25:
+         return 25;
+      case MCI_SEQ_SET_SMPTE_30:
+      case MCI_SEQ_SET_SMPTE_30DROP:
+         return 30;
+      }  /* on switch */
+
+   return 0;
+}
+
+
+
 /****************************************************************************/
 /*                                                                          */
 /* SUBROUTINE NAME:  ConvertTime                                            */
 /*                                                                          */
 /* DESCRIPTIVE NAME:  Convert time from one format to another.              */
 /*                                                                          */
+/* FUNCTION:  The time is converted to milliseconds first, and then to the  */
+/*            new format.  Song pointers go through the tempo map of the    */
+/*            MIDI file.  SMPTE times are packed as hours, minutes, seconds */
+/*            and frames from the low byte.                                 */
+/*                                                                          */
 /* PARAMETERS:                                                              */
 /*      PINSTANCE pInstance -- pointer to instance.                         */
-/*                                                                          */
-/* NOTES: This is just the start of a routine to convert from one time      */
-/*        format to another.  You should add and delete to this routine     */
-/*        as required by your MCD.                                          */
+/*      ULONG ulTime -- time to convert.                                    */
+/*      ULONG ulCurrentFormat -- format of ulTime.                          */
+/*      ULONG ulNewFormat -- format to convert to.                          */
 /*                                                                          */
 /****************************************************************************/
-ULONG  ConvertTime(ULONG ulTime, ULONG ulCurrentFormat, ULONG ulNewFormat)
+ULONG  ConvertTime(PINSTANCE pInstance, ULONG ulTime, ULONG ulCurrentFormat,
+                   ULONG ulNewFormat)
 {
+   ULONG ulMs;
    ULONG ulNewTime=0;
+   ULONG ulFps;
+   SMFINFO *pSmf = &pInstance->smf;
 
+   if (ulCurrentFormat == ulNewFormat)
+      return(ulTime);
+
+   /***************************/
+   /* convert to milliseconds */
+   /***************************/
    switch (ulCurrentFormat)
       {
-      case MCI_FORMAT_MILLISECONDS:                // MILLISECONDS
-        switch (ulNewFormat)
-           {
-           case MCI_FORMAT_MMTIME:                 // MMTIME
-              ulNewTime = MSECTOMM(ulTime);
-              break;
-           default :
-              ulNewTime = ulTime;
-           }  /* on switch */
+      case MCI_FORMAT_MMTIME:                      // MMTIME
+         ulMs = MSECFROMMM(ulTime);
+         break;
 
+      case MCI_SEQ_SET_SONGPTR:                    // 16th notes
+         ulMs = pSmf->ulTracks && !(pSmf->usDivision & 0x8000) ?
+                MidiTicksToMs(pSmf, ulTime * pSmf->usDivision / 4) : 0;
          break;
+
+      case MCI_SEQ_SET_SMPTE_24:                   // HOURS, MINUTES,
+      case MCI_SEQ_SET_SMPTE_25:                   // SECONDS, FRAMES
+      case MCI_SEQ_SET_SMPTE_30:
+      case MCI_SEQ_SET_SMPTE_30DROP:
+         ulFps = SmpteFps(ulCurrentFormat);
+         ulMs = ((ulTime & 0xFF) * 3600 + ((ulTime >> 8) & 0xFF) * 60 +
+                 ((ulTime >> 16) & 0xFF)) * 1000 +
+                ((ulTime >> 24) & 0xFF) * 1000 / ulFps;
+         break;
+
+      case MCI_FORMAT_MILLISECONDS:                // MILLISECONDS
+      default :
+         ulMs = ulTime;
+      }  /* on switch */
+
+   /*****************************/
+   /* convert to the new format */
+   /*****************************/
+   switch (ulNewFormat)
+      {
       case MCI_FORMAT_MMTIME:                      // MMTIME
-        switch (ulNewFormat)
-           {
-           case MCI_FORMAT_MILLISECONDS:           // MILLISECONDS
-              ulNewTime = MSECFROMMM(ulTime);
-              break;
-           default :
-              ulNewTime = ulTime;
-           }  /* on switch */
+         ulNewTime = MSECTOMM(ulMs);
+         break;
+
+      case MCI_SEQ_SET_SONGPTR:                    // 16th notes
+         ulNewTime = pSmf->ulTracks && pSmf->usDivision &&
+                     !(pSmf->usDivision & 0x8000) ?
+                     MidiMsToTicks(pSmf, ulMs) * 4 / pSmf->usDivision : 0;
+         break;
+
+      case MCI_SEQ_SET_SMPTE_24:                   // HOURS, MINUTES,
+      case MCI_SEQ_SET_SMPTE_25:                   // SECONDS, FRAMES
+      case MCI_SEQ_SET_SMPTE_30:
+      case MCI_SEQ_SET_SMPTE_30DROP:
+         ulFps = SmpteFps(ulNewFormat);
+         ulNewTime = (ulMs / 3600000 & 0xFF) |
+                     (ulMs / 60000 % 60) << 8 |
+                     (ulMs / 1000 % 60) << 16 |
+                     (ulMs % 1000 * ulFps / 1000) << 24;
          break;
 
-      case MCI_FORMAT_MSF:                    // MINUTE, SECONDS, FRAMES
-      case MCI_FORMAT_TMSF:                   // TRACKS, MINUTE, SECONDS, FRAMES
-      case MCI_FORMAT_CHAPTERS:               // CHAPTERS
-      case MCI_FORMAT_FRAMES:                 // FRAMES
-      case MCI_FORMAT_HMS:                    // HOURS, MINUTES, SECONDS
-      case MCI_FORMAT_HMSF:                   // HOURS, MINUTES, SECONDS, FRAMES
-      case MCI_FORMAT_TRACKS:                 // TRACKS
-      case MCI_FORMAT_BYTES:                  // BYTES
-      case MCI_FORMAT_SAMPLES:                // SAMPLES
+      case MCI_FORMAT_MILLISECONDS:                // MILLISECONDS
       default :
-         ulNewTime = ulTime;
+         ulNewTime = ulMs;
       }  /* on switch */
 
    return(ulNewTime);
@@ -261,3 +330,223 @@ ULONG  ConvertTime(ULONG ulTime, ULONG ulCurrentFormat, ULONG ulNewFormat)
 
 
 
+
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GetDevParam                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Get a configuration value                             */
+/*                                                                          */
+/* FUNCTION:  Look up NAME=value in the device parameters of the instance.  */
+/*            Items are separated by commas or blanks, and NAME alone means */
+/*            NAME=1.  If NAME is not there, KSOFTSEQ_NAME environment      */
+/*            variable is used instead.                                     */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance.                         */
+/*      PCSZ      pszName   -- name of the value.                           */
+/*      PSZ       pszValue  -- buffer receiving the value.                  */
+/*      ULONG     ulSize    -- size of pszValue.                            */
+/*                                                                          */
+/* EXIT CODES:  TRUE if the value is found, FALSE otherwise.                */
+/*                                                                          */
+/****************************************************************************/
+BOOL GetDevParam(PINSTANCE pInstance, PCSZ pszName, PSZ pszValue, ULONG ulSize)
+{
+   ULONG ulNameLen = strlen(pszName);
+   PCSZ  p = pInstance ? pInstance->szDevParams : "";
+   CHAR  szEnvName[64];
+
+   while (*(p += strspn(p, ", \t")))
+      {
+      ULONG ulLen = strcspn(p, ", \t");
+
+      if (ulLen >= ulNameLen && !strnicmp(p, pszName, ulNameLen))
+         {
+         if (ulLen == ulNameLen)
+            {
+            snprintf(pszValue, ulSize, "1");
+            return TRUE;
+            }
+
+         if (p[ulNameLen] == '=')
+            {
+            snprintf(pszValue, ulSize, "%.*s",
+                     (int)(ulLen - ulNameLen - 1), p + ulNameLen + 1);
+            return TRUE;
+            }
+         }
+
+      p += ulLen;
+      }
+
+   snprintf(szEnvName, sizeof(szEnvName), "KSOFTSEQ_%s", pszName);
+
+   if ((p = getenv(szEnvName)))
+      {
+      snprintf(pszValue, ulSize, "%s", p);
+      return TRUE;
+      }
+
+   return FALSE;
+
+}  /* end of GetDevParam() */
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GetDevParamULong                                       */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Get a numeric configuration value                     */
+/*                                                                          */
+/* FUNCTION:  Same as GetDevParam(), but convert the value to a number.     */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance.                         */
+/*      PCSZ      pszName   -- name of the value.                           */
+/*      ULONG     ulDefault -- value returned if not found.                 */
+/*                                                                          */
+/****************************************************************************/
+ULONG GetDevParamULong(PINSTANCE pInstance, PCSZ pszName, ULONG ulDefault)
+{
+   CHAR szValue[32];
+
+   if (!GetDevParam(pInstance, pszName, szValue, sizeof(szValue)))
+      return ulDefault;
+
+   return strtoul(szValue, NULL, 0);
+
+}  /* end of GetDevParamULong() */
+
+
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  QueryTimerMs                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Query the high resolution timer                       */
+/*                                                                          */
+/* EXIT CODES:  Time in ms                                                  */
+/*                                                                          */
+/****************************************************************************/
+ULONG QueryTimerMs(VOID)
+{
+   static ULONG ulFreq = 0;
+   QWORD qwTime;
+
+   if (!ulFreq)
+      DosTmrQueryFreq(&ulFreq);
+
+   DosTmrQueryTime(&qwTime);
+
+   return(((unsigned long long)qwTime.ulHi << 32 | qwTime.ulLo) * 1000 / ulFreq);
+}
+
+
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  AudiblePosition                                        */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Get the position being heard                          */
+/*                                                                          */
+/* FUNCTION:  Subtract the audio queued in the output buffers from the      */
+/*            position of the decoder.  The audio queued is not more than   */
+/*            the one decoded since playing started at ulStartPosition.     */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance.                         */
+/*      ULONG     ulPos     -- position of the decoder in ms.               */
+/*                                                                          */
+/* EXIT CODES:  Position in ms                                              */
+/*                                                                          */
+/****************************************************************************/
+ULONG AudiblePosition(PINSTANCE pInstance, ULONG ulPos)
+{
+   if (ulPos < pInstance->ulStartPosition)
+      return(ulPos);
+
+   if (ulPos - pInstance->ulStartPosition < pInstance->ulLatency)
+      return(pInstance->ulStartPosition);
+
+   return(ulPos - pInstance->ulLatency);
+}
+
+
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GetPosition                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Get the current position                              */
+/*                                                                          */
+/* FUNCTION:  Get the position being heard while playing or paused, or the  */
+/*            position of the decoder otherwise.  Until the first buffer    */
+/*            is played, the position is where playing started.             */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance.                         */
+/*                                                                          */
+/* EXIT CODES:  Position in ms                                              */
+/*                                                                          */
+/****************************************************************************/
+ULONG GetPosition(PINSTANCE pInstance)
+{
+   ULONG ulPos;
+   ULONG ulStatus;
+   ULONG ulElapsed;
+
+   /* at the start if a decoder is not opened yet */
+   if (pInstance->LazyLoad || !pInstance->dec)
+      return(0);
+
+   ulStatus = kaiStatus(pInstance->hkai);
+
+   if (!(ulStatus & (KAIS_PLAYING | KAIS_PAUSED)))
+      return(kmdecGetPosition(pInstance->dec));
+
+   /* the decoder may be ahead by the blocks rendered ahead */
+   if (!pInstance->Stamped)
+      return(AudiblePosition(pInstance, pInstance->ulStartPosition));
+
+   ulPos = pInstance->ulStampPos;
+
+   /***************************************************/
+   /* extrapolate by the time since the last stamp,   */
+   /* but not beyond the buffer being played          */
+   /***************************************************/
+   if (!(ulStatus & KAIS_PAUSED))
+      {
+      ulElapsed = QueryTimerMs() - pInstance->ulStampTime;
+      if (ulElapsed > pInstance->ulBufferTime)
+         ulElapsed = pInstance->ulBufferTime;
+
+      ulPos += ulElapsed;
+      }
+
+   return(ulPos);
+}
+
+
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  StampPosition                                          */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Record the position heard now                         */
+/*                                                                          */
+/* FUNCTION:  Record the position heard with the current time of the high   */
+/*            resolution timer, from which GetPosition() extrapolates the   */
+/*            position until the next stamp.                                */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance.                         */
+/*      ULONG     ulPos     -- position heard in ms.                        */
+/*                                                                          */
+/****************************************************************************/
+VOID StampPosition(PINSTANCE pInstance, ULONG ulPos)
+{
+   pInstance->ulStampPos = ulPos;
+   pInstance->ulStampTime = QueryTimerMs();
+   pInstance->Stamped = TRUE;
+}
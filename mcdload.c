@@ -33,9 +33,15 @@
 /*                                                                          */
 /* ENTRY POINTS:                                                            */
 /*       MCILoad() - MCI_LOAD message handler                               */
+/*       OpenDecoder() - Open a decoder for MIDI                            */
+/*       CloseDecoder() - Close a decoder for MIDI                          */
+/*       StartLoad() - Start loading MIDI in background                     */
+/*       WaitLoad() - Wait for loading MIDI in background                   */
+/*       LoadLazily() - Open a decoder deferred by LAZYLOAD                 */
 /****************************************************************************/
 #define INCL_BASE                    // Base OS2 functions
 #define INCL_DOSSEMAPHORES           // OS2 Semaphore function
+#define INCL_DOSEXCEPTIONS           // OS2 Exception function
 #define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
 
 #include <os2.h>                     // OS2 defines.
@@ -44,7 +50,11 @@
 #include <stdlib.h>                  // Math functions
 #include "mcdtemp.h"                 // Function Prototypes.
 
-#include <sys/stat.h>                // stat()
+#include <process.h>                 // _beginthread()
+
+#include <errno.h>                   // errno, EINVAL
+
+#define LOAD_STACK_SIZE     ( 1024 * 1024 )
 
 /***********************************************/
 /* MCI_LOAD valid flags                  */
@@ -53,6 +63,337 @@
                              MCI_OPEN_ELEMENT | MCI_OPEN_MMIO)
 
 
+static int memRead(int fd, void *buf, size_t n)
+{
+    MEMSTREAM *ms = (MEMSTREAM *)fd;
+
+    if (n > ms->ulSize - ms->ulPos)
+        n = ms->ulSize - ms->ulPos;
+
+    memcpy(buf, ms->pb + ms->ulPos, n);
+    ms->ulPos += n;
+
+    return n;
+}
+
+static int memSeek(int fd, long offset, int origin)
+{
+    MEMSTREAM *ms = (MEMSTREAM *)fd;
+
+    switch (origin)
+    {
+        case SEEK_SET:
+            break;
+
+        case SEEK_CUR:
+            offset += ms->ulPos;
+            break;
+
+        case SEEK_END:
+            offset += ms->ulSize;
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if (offset < 0 || offset > ms->ulSize)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ms->ulPos = offset;
+
+    return offset;
+}
+
+static int memTell(int fd)
+{
+    MEMSTREAM *ms = (MEMSTREAM *)fd;
+
+    return ms->ulPos;
+}
+
+/* io for MIDI in memory */
+static KMDECIOFUNCS memio = {
+    .open = NULL,
+    .read = memRead,
+    .seek = memSeek,
+    .tell = memTell,
+    .close = NULL
+};
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  OpenDecoder                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Open a decoder for MIDI                               */
+/*                                                                          */
+/* FUNCTION:  Open a decoder for MIDI with the SoundFont of the instance.   */
+/*            A type-1 MIDI file is flattened into one track in memory      */
+/*            unless FLATTEN=0.  Redundant controller messages are thinned  */
+/*            within THIN ms while flattening, and a type-0 MIDI file is    */
+/*            rewritten in memory for it.  THIN is 0, that is, disabled by  */
+/*            default.                                                      */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance      -- Pointer to instance.                   */
+/*      ULONG      ulParam1       -- MCI_OPEN_ELEMENT or MCI_OPEN_MMIO.     */
+/*      PSZ        pszElementName -- File name or HMMIO.                    */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      Decoder, or NULL on error.                                          */
+/*                                                                          */
+/****************************************************************************/
+PKMDEC OpenDecoder(PINSTANCE pInstance, ULONG ulParam1, PSZ pszElementName)
+{
+    PKMDEC dec = NULL;
+    CHAR sf2[CCHMAXPATH];
+    ULONG ulStart = QueryTimerMs();
+
+    GetSoundFont(pInstance, sf2, sizeof(sf2));
+
+    smplmemExpect(pInstance, sf2);
+
+    ULONG ulThinMs = GetDevParamULong(pInstance, "THIN", 0);
+
+    if (ulParam1 & MCI_OPEN_ELEMENT && pInstance->smf.ulTracks &&
+        (pInstance->smf.ulFormat == 1 ?
+            GetDevParamULong(pInstance, "FLATTEN", 1) :
+            pInstance->smf.ulFormat == 0 && ulThinMs) &&
+        (pInstance->flat.pb = FlattenMidi(pszElementName, &pInstance->smf,
+                                          ulThinMs,
+                                          &pInstance->flat.ulSize)))
+    {
+        pInstance->flat.ulPos = 0;
+
+        dec = kmdecOpenFdEx((int)&pInstance->flat, sf2, &pInstance->ai,
+                            &memio);
+    }
+    else if (ulParam1 & MCI_OPEN_ELEMENT)
+        dec = kmdecOpen(pszElementName, sf2, &pInstance->ai);
+    else /* if (ulParam1 & MCI_OPEN_MMIO) */
+    {
+        MMIOSTREAM *ms = &pInstance->mmio;
+        extern KMDECIOFUNCS io;
+
+        ms->hmmio = (HMMIO)pszElementName;
+        ms->ulPos = mmioSeek(ms->hmmio, 0, SEEK_CUR);
+        ms->ulFilePos = ms->ulPos;
+        ms->ulBase = 0;
+        ms->ulLen = 0;
+
+        if (ms->ulPos != MMIO_ERROR &&
+            (ms->pb = malloc(MMIO_BUF_SIZE)))
+            dec = kmdecOpenFdEx((int)ms, sf2, &pInstance->ai, &io);
+    }
+
+    smplmemExpectDone();
+
+    LOG_MSG(pInstance->ulDepth, "decoder = %p, opened in %lu ms",
+            dec, QueryTimerMs() - ulStart);
+
+    if (!dec)
+    {
+        free(pInstance->flat.pb);
+        pInstance->flat.pb = NULL;
+
+        free(pInstance->mmio.pb);
+        pInstance->mmio.pb = NULL;
+    }
+
+    return dec;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  CloseDecoder                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Close a decoder for MIDI                              */
+/*                                                                          */
+/* FUNCTION:  Close a decoder opened by OpenDecoder().                      */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance      -- Pointer to instance.                   */
+/*                                                                          */
+/****************************************************************************/
+VOID CloseDecoder(PINSTANCE pInstance)
+{
+    kmdecClose(pInstance->dec);
+    pInstance->dec = NULL;
+
+    free(pInstance->flat.pb);
+    pInstance->flat.pb = NULL;
+
+    free(pInstance->mmio.pb);
+    pInstance->mmio.pb = NULL;
+}
+
+/* thread loading MIDI in background */
+static void loadThread(void *arg)
+{
+    PINSTANCE pInst = arg;
+    LOADNOTIFY *notify = &pInst->loadNotify;
+    EXCEPTIONREGISTRATIONRECORD xcptRegRec = { NULL, smplmemHandler };
+
+    /* sample data of SoundFont may be committed on access */
+    DosSetExceptionHandler(&xcptRegRec);
+
+    PKMDEC dec = OpenDecoder(pInst, notify->ulParam1, notify->pszElementName);
+
+    DosRequestMutexSem(pInst->hmtxAccessSem, SEM_INDEFINITE_WAIT);
+
+    LOG_MSG(pInst->ulDepth, "loaded in background, dec = %p", dec);
+
+    pInst->dec = dec;
+    pInst->ulLoadError = dec ? MCIERR_SUCCESS : MCIERR_DRIVER_INTERNAL;
+    pInst->ulState = notify->ulSavedState;
+    pInst->tidLoad = 0;
+
+    if (notify->hwndCallback)
+        mdmDriverNotify(pInst->usDeviceID,
+                        notify->hwndCallback,
+                        MM_MCINOTIFY,
+                        notify->usUserParm,
+                        MAKEULONG(notify->usMessage,
+                                  dec ? MCI_NOTIFY_SUCCESSFUL :
+                                        pInst->ulLoadError));
+
+    DosReleaseMutexSem(pInst->hmtxAccessSem);
+
+    DosUnsetExceptionHandler(&xcptRegRec);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  StartLoad                                              */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Start loading MIDI in background                      */
+/*                                                                          */
+/* FUNCTION:  Open a decoder for MIDI in another thread, and notify         */
+/*            usMessage to hwndCallback when done.  The instance is in      */
+/*            MCD_MODE_LOADING state until then.                            */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance      -- Pointer to instance.                   */
+/*      USHORT     usMessage      -- MCI_OPEN or MCI_LOAD.                  */
+/*      ULONG      ulParam1       -- MCI_OPEN_ELEMENT or MCI_OPEN_MMIO.     */
+/*      PSZ        pszElementName -- File name or HMMIO.                    */
+/*      HWND       hwndCallback   -- Window to notify, or NULLHANDLE.       */
+/*      USHORT     usUserParm     -- User parameter to notify.              */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      MCIERR_SUCCESS    -- Action completed without error.                */
+/*      MCIERR_DRIVER_INTERNAL -- Cannot start a thread.                    */
+/*                                                                          */
+/****************************************************************************/
+RC StartLoad(PINSTANCE pInstance, USHORT usMessage, ULONG ulParam1,
+             PSZ pszElementName, HWND hwndCallback, USHORT usUserParm)
+{
+    LOADNOTIFY *notify = &pInstance->loadNotify;
+    RC rc = MCIERR_SUCCESS;
+
+    /* a loading thread should not finish before tidLoad is set */
+    DosRequestMutexSem(pInstance->hmtxAccessSem, SEM_INDEFINITE_WAIT);
+
+    notify->hwndCallback = hwndCallback;
+    notify->usMessage = usMessage;
+    notify->usUserParm = usUserParm;
+    notify->ulParam1 = ulParam1;
+    notify->pszElementName = pszElementName;
+    notify->ulSavedState = pInstance->ulState;
+
+    pInstance->dec = NULL;
+    pInstance->ulState = MCD_MODE_LOADING;
+
+    int tid = _beginthread(loadThread, NULL, LOAD_STACK_SIZE, pInstance);
+
+    if (tid == -1)
+    {
+        pInstance->ulState = notify->ulSavedState;
+
+        rc = MCIERR_DRIVER_INTERNAL;
+    }
+    else
+        pInstance->tidLoad = tid;
+
+    DosReleaseMutexSem(pInstance->hmtxAccessSem);
+
+    return rc;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  WaitLoad                                               */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Wait for loading MIDI in background                   */
+/*                                                                          */
+/* FUNCTION:  Wait for the thread started by StartLoad().  hmtxAccessSem    */
+/*            should be owned, and it is released while waiting.            */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance      -- Pointer to instance.                   */
+/*                                                                          */
+/****************************************************************************/
+VOID WaitLoad(PINSTANCE pInstance)
+{
+    TID tid;
+
+    while ((tid = pInstance->tidLoad) != 0)
+    {
+        LOG_MSG(pInstance->ulDepth, "waiting for thread %ld", tid);
+
+        DosReleaseMutexSem(pInstance->hmtxAccessSem);
+
+        DosWaitThread(&tid, DCWW_WAIT);
+
+        DosRequestMutexSem(pInstance->hmtxAccessSem, SEM_INDEFINITE_WAIT);
+    }
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  LoadLazily                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Open a decoder deferred by LAZYLOAD                   */
+/*                                                                          */
+/* FUNCTION:  With LAZYLOAD, only MIDI file is parsed when opened or        */
+/*            loaded, and a decoder with SoundFont is opened when it is     */
+/*            needed first, that is, on MCI_PLAY, MCI_CUE or MCI_SEEK.      */
+/*            Without it, the error of the last load is returned if no      */
+/*            decoder is opened, for example, if loading in background has  */
+/*            failed.                                                       */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance      -- Pointer to instance.                   */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      MCIERR_SUCCESS    -- Action completed without error.                */
+/*      MCIERR_DRIVER_INTERNAL -- Cannot open a decoder.                    */
+/*      Others            -- Error of the last load.                        */
+/*                                                                          */
+/****************************************************************************/
+RC LoadLazily(PINSTANCE pInstance)
+{
+    if (!pInstance->LazyLoad)
+        return pInstance->dec ? MCIERR_SUCCESS : pInstance->ulLoadError;
+
+    pInstance->LazyLoad = FALSE;
+
+    LOG_MSG(pInstance->ulDepth, "open a decoder for [%s]",
+            pInstance->szFileName);
+
+    pInstance->dec = OpenDecoder(pInstance, MCI_OPEN_ELEMENT,
+                                 pInstance->szFileName);
+
+    pInstance->ulLoadError = pInstance->dec ? MCIERR_SUCCESS :
+                                              MCIERR_DRIVER_INTERNAL;
+
+    return pInstance->ulLoadError;
+}
+
 /****************************************************************************/
 /*                                                                          */
 /* SUBROUTINE NAME:  MCILoad                                                */
@@ -98,44 +439,49 @@ RC MCILoad(FUNCTION_PARM_BLOCK *pFuncBlock)
 
     kaiStop(pInst->hkai);
 
-    kmdecClose(pInst->dec);
+    RenderFlush(pInst, FALSE);
 
-    KMDECAUDIOINFO ai;
+    CloseDecoder(pInst);
 
-    ai.bps = KMDEC_BPS_S16;
-    ai.channels = 2;
-    ai.sampleRate = 44100;
+    pInst->LazyLoad = FALSE;
 
-    const char *sf2 = getenv("KSOFTSEQ_SF2");
-    struct stat st;
-
-    if (!sf2 || stat(sf2, &st) == -1)
-        sf2 = szDefaultSf2;
-
-    LOG_MSG(pInst->ulDepth, "sf2 = [%s]", sf2);
+    PSZ pszElementName = pParam2->pszElementName;
 
     if (ulParam1 & MCI_OPEN_ELEMENT)
     {
         strcpy(pInst->szFileName, pParam2->pszElementName);
 
-        pInst->dec = kmdecOpen(pInst->szFileName, sf2, &ai);
-    }
-    else /* if (ulParam1 & MCI_OPEN_MMIO) */
-    {
-        HMMIO fd = (HMMIO)pParam2->pszElementName;
-        extern KMDECIOFUNCS io;
+        pszElementName = pInst->szFileName;
 
-        pInst->dec = kmdecOpenFdEx(fd, sf2, &ai, &io);
+        FreeMidiInfo(&pInst->smf);
+        QueryMidiInfo(pInst->szFileName, &pInst->smf);
     }
-
-    if (!pInst->dec)
-        rc = MCIERR_DRIVER_INTERNAL;
+    else
+        FreeMidiInfo(&pInst->smf);
 
     memset(pInst->cueNotify, 0, sizeof(pInst->cueNotify));
 
     pInst->adviseNotify.ulUnits = 0;
     pInst->adviseNotify.ulNext = 0;
 
+    /* open a decoder when needed first */
+    if (pInst->smf.ulTracks && GetDevParamULong(pInst, "LAZYLOAD", 0))
+        pInst->LazyLoad = TRUE;
+    /* load in background, and notify when done */
+    else if ((ulParam1 & MCI_NOTIFY && !(ulParam1 & MCI_WAIT)) ||
+             GetDevParamULong(pInst, "ASYNCLOAD", 0))
+    {
+        rc = StartLoad(pInst, MCI_LOAD, ulParam1, pszElementName,
+                       ulParam1 & MCI_NOTIFY ? pParam2->hwndCallback : 0,
+                       pFuncBlock->usUserParm);
+
+        LOG_RETURN(pInst->ulDepth--, rc);
+    }
+    else if (!(pInst->dec = OpenDecoder(pInst, ulParam1, pszElementName)))
+        rc = MCIERR_DRIVER_INTERNAL;
+
+    pInst->ulLoadError = rc;
+
     /***************************************************************/
     /* Send back a notification if the notify flag was on          */
     /***************************************************************/
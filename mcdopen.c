@@ -39,6 +39,7 @@
 /****************************************************************************/
 #define INCL_BASE                    // Base OS2 functions
 #define INCL_DOSSEMAPHORES           // OS2 Semaphore function
+#define INCL_DOSEXCEPTIONS           // OS2 Exception function
 #define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
 
 #include <os2.h>                     // OS2 defines.
@@ -48,7 +49,6 @@
 #include "mcdtemp.h"                 // Function Prototypes.
 
 #include <errno.h>                   // errno, EINVAL
-#include <sys/stat.h>                // stat()
 
 /* callback for KAI */
 static ULONG APIENTRY kaiCallback(PVOID pCBData,
@@ -56,17 +56,39 @@ static ULONG APIENTRY kaiCallback(PVOID pCBData,
 {
     PINSTANCE pInst = pCBData;
     ULONG rc = ERROR_TIMEOUT;
+    EXCEPTIONREGISTRATIONRECORD xcptRegRec = { NULL, smplmemHandler };
 
-    /* prevent dead-lock in MCIPlay(), MCIStop() and MCIClose() */
+    /* sample data of SoundFont may be committed on access */
+    DosSetExceptionHandler(&xcptRegRec);
+
+    /* take a block rendered ahead without waiting for the instance */
+    ULONG ulRenderPos = pInst->ulStartPosition;
+    int written = RenderRead(pInst, pBuffer, ulBufferSize, &ulRenderPos);
+
+    /*******************************************************/
+    /* prevent dead-lock in MCIPlay(), MCIStop() and       */
+    /* MCIClose().  The thread rendering ahead holds the   */
+    /* instance only while checking what to render.        */
+    /*******************************************************/
     while (!pInst->AvoidDeadLock && rc == ERROR_TIMEOUT)
         rc = DosRequestMutexSem(pInst->hmtxAccessSem, 500);
 
-    int written = kmdecDecode(pInst->dec, pBuffer, ulBufferSize);
+    /* nothing to play if loading has failed */
+    if (written < 0 && !pInst->dec)
+        written = 0;
+
+    /* wait for the block being rendered ahead, or decode */
+    if (written < 0)
+        written = RenderWait(pInst, pBuffer, ulBufferSize, &ulRenderPos);
 
-    int pos = kmdecGetPosition(pInst->dec);
+    int pos = ulRenderPos;
 
-    if (pInst->ulEndPosition && pos > pInst->ulEndPosition)
-        written = 0;
+    /* volume is applied in float, not by KAI */
+    if (written > 0)
+        GainApply(pInst, pBuffer, written);
+
+    /* a buffer has been played, and the next one starts now */
+    StampPosition(pInst, AudiblePosition(pInst, pos));
 
     if (written < ulBufferSize && pInst->playNotify.hwndCallback)
     {
@@ -76,75 +98,150 @@ static ULONG APIENTRY kaiCallback(PVOID pCBData,
                         MAKEULONG(MCI_PLAY, MCI_NOTIFY_SUCCESSFUL));
     }
 
-    for (int i = 0; i < MAX_CUE_POINTS; i++)
-    {
-        CUENOTIFY *notify = &pInst->cueNotify[i];
+    /*******************************************************/
+    /* notify the rest at the end, otherwise let the       */
+    /* thread notify at the position being heard           */
+    /*******************************************************/
+    if (written < ulBufferSize)
+        NotifyPosition(pInst, pos);
+    else if (!NotifyWake(pInst))
+        NotifyPosition(pInst, pInst->ulStampPos);
 
-        if (notify->On && !notify->Notified && notify->ulCuepoint <= pos)
-        {
-            notify->Notified = TRUE;
+    if (!rc)
+        DosReleaseMutexSem(pInst->hmtxAccessSem);
 
-            mdmDriverNotify(pInst->usDeviceID,
-                            notify->hwndCallback,
-                            MM_MCICUEPOINT, notify->usUserParm,
-                            MSECTOMM(notify->ulCuepoint));
+    DosUnsetExceptionHandler(&xcptRegRec);
 
-        }
-    }
+    return written;
+}
 
-    ULONG ulNext = pInst->adviseNotify.ulNext;
+/* fill the buffer with the block containing the current offset */
+static BOOL ioFill(MMIOSTREAM *ms)
+{
+    ULONG ulBase = ms->ulPos & ~(MMIO_BUF_SIZE - 1);
+    LONG  lRead;
 
-    if (ulNext > 0)
-    {
-        while (ulNext < pos)
-        {
-            mdmDriverNotify(pInst->usDeviceID,
-                            pInst->adviseNotify.hwndCallback,
-                            MM_MCIPOSITIONCHANGE,
-                            pInst->adviseNotify.usUserParm,
-                            MSECTOMM(ulNext));
+    /* keep reading on without seeking back, which translating IOProcs
+       may do slowly */
+    if (ms->ulPos == ms->ulFilePos)
+        ulBase = ms->ulPos;
 
-            ulNext += pInst->adviseNotify.ulUnits;
-        }
+    if (ms->ulFilePos != ulBase)
+    {
+        if (mmioSeek(ms->hmmio, ulBase, SEEK_SET) == MMIO_ERROR)
+            return FALSE;
 
-        pInst->adviseNotify.ulNext = ulNext;
+        ms->ulFilePos = ulBase;
     }
 
-    if (!rc)
-        DosReleaseMutexSem(pInst->hmtxAccessSem);
+    lRead = mmioRead(ms->hmmio, (PCHAR)ms->pb, MMIO_BUF_SIZE);
+    if (lRead == MMIO_ERROR)
+        return FALSE;
 
-    return written;
+    ms->ulBase = ulBase;
+    ms->ulLen = lRead;
+    ms->ulFilePos += lRead;
+
+    return TRUE;
 }
 
 static int ioRead(int fd, void *buf, size_t n)
 {
-    ULONG rc = mmioRead(fd, buf, n);
+    MMIOSTREAM *ms = (MMIOSTREAM *)fd;
+    PBYTE pb = buf;
+    size_t total = 0;
+
+    while (total < n)
+    {
+        if (ms->ulPos < ms->ulBase || ms->ulPos >= ms->ulBase + ms->ulLen)
+        {
+            if (n - total >= MMIO_BUF_SIZE && ms->ulPos == ms->ulFilePos)
+            {
+                /* read large blocks directly without copying */
+                LONG lRead = mmioRead(ms->hmmio, (PCHAR)pb + total,
+                                      (n - total) & ~(MMIO_BUF_SIZE - 1));
+
+                if (lRead == MMIO_ERROR)
+                    return total ? total : -1;
+
+                if (lRead == 0)
+                    break;              /* end of file */
+
+                ms->ulPos += lRead;
+                ms->ulFilePos += lRead;
+                total += lRead;
+
+                continue;
+            }
+
+            if (!ioFill(ms))
+                return total ? total : -1;
+
+            if (ms->ulPos >= ms->ulBase + ms->ulLen)
+                break;                  /* end of file */
+        }
+
+        size_t len = ms->ulBase + ms->ulLen - ms->ulPos;
+
+        if (len > n - total)
+            len = n - total;
+
+        memcpy(pb + total, ms->pb + ms->ulPos - ms->ulBase, len);
+        ms->ulPos += len;
+        total += len;
+    }
 
-    return rc == MMIO_ERROR ? -1 : rc;
+    return total;
 }
 
 static int ioSeek(int fd, long offset, int origin)
 {
-    static LONG lOrigins[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+    MMIOSTREAM *ms = (MMIOSTREAM *)fd;
+    LONG lSize;
+
+    switch (origin)
+    {
+        case SEEK_SET:
+            break;
+
+        case SEEK_CUR:
+            offset += ms->ulPos;
+            break;
+
+        case SEEK_END:
+            lSize = mmioSeek(ms->hmmio, 0, SEEK_END);
+            if (lSize == MMIO_ERROR)
+                return -1;
+
+            ms->ulFilePos = lSize;
+            offset += lSize;
+            break;
 
-    if( origin >= sizeof( lOrigins ) / sizeof( lOrigins[ 0 ]))
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if (offset < 0)
     {
         errno = EINVAL;
         return -1;
     }
 
-    ULONG rc = mmioSeek(fd, offset, lOrigins[origin]);
+    /* MMIO handle is moved when the buffer is filled next */
+    ms->ulPos = offset;
 
-    return rc == MMIO_ERROR ? -1 : rc;
+    return offset;
 }
 
 static int ioTell(int fd)
 {
-    ULONG rc = mmioSeek(fd, 0, SEEK_CUR);
+    MMIOSTREAM *ms = (MMIOSTREAM *)fd;
 
-    return rc == MMIO_ERROR ? -1 : rc;
+    return ms->ulPos;
 }
 
+/* io for MMIO with read-ahead buffer */
 KMDECIOFUNCS io = {
     .open = NULL,
     .read = ioRead,
@@ -153,12 +250,29 @@ KMDECIOFUNCS io = {
     .close = NULL
 };
 
+/***********************************************/
+/* Output buffer profiles                      */
+/***********************************************/
+typedef struct {
+    PCSZ  pszName;
+    ULONG ulNumBuffers;
+    ULONG ulBufferFrames;
+} BUFPROFILE;
+
+static const BUFPROFILE bufProfiles[] = {
+    { "default",     2, 4096 },     /* about 186 ms at 44.1 kHz */
+    { "low-latency", 4, 256  },     /* about 23 ms */
+    { "robust",      4, 8192 },     /* about 743 ms */
+};
+
 /***********************************************/
 /* MCI_OPEN valid flags                        */
 /*  NOTE --> MCI_NOTIFY will never be sent     */
 /*           open notify is handled by MDM     */
+/*           If sent without MCI_WAIT, load in */
+/*           background                        */
 /***********************************************/
-#define MCIOPENVALIDFLAGS    (MCI_OPEN_SHAREABLE | MCI_WAIT | MCI_OPEN_ELEMENT | MCI_OPEN_PLAYLIST | MCI_OPEN_MMIO)
+#define MCIOPENVALIDFLAGS    (MCI_OPEN_SHAREABLE | MCI_WAIT | MCI_NOTIFY | MCI_OPEN_ELEMENT | MCI_OPEN_PLAYLIST | MCI_OPEN_MMIO)
 
 
 /****************************************************************************/
@@ -233,6 +347,14 @@ RC MCIOpen (FUNCTION_PARM_BLOCK *pFuncBlock)
         pInstance->Active = FALSE;
         pInstance->ulVolume = 75L;
         pInstance->ulMasterVolume = -1L;
+        pInstance->aulVolume[0] = 100;
+        pInstance->aulVolume[1] = 100;
+        pInstance->AudioOn[0] = TRUE;
+        pInstance->AudioOn[1] = TRUE;
+        pInstance->ulDitherSeed = 1;
+        pInstance->ulLoadError = MCIERR_DRIVER_INTERNAL;    /* no element */
+        pInstance->afGain[0] = 1.0f;
+        pInstance->afGain[1] = 1.0f;
         pInstance->Speaker = TRUE;
         pInstance->Headphone = TRUE;
         pInstance->usDeviceType = pDrvOpenParms->usDeviceType;
@@ -244,63 +366,58 @@ RC MCIOpen (FUNCTION_PARM_BLOCK *pFuncBlock)
         GetINIInstallName(pInstance);
         GetDeviceInfo(pInstance);
 
-        KMDECAUDIOINFO ai;
+        pInstance->ai.bps = KMDEC_BPS_S16;
+        pInstance->ai.channels = 2;
+        pInstance->ai.sampleRate = GetDevParamULong(pInstance, "RATE", 44100);
 
-        ai.bps = KMDEC_BPS_S16;
-        ai.channels = 2;
-        ai.sampleRate = 44100;
+        KAISPEC ksWanted, ksObtained;
+        const BUFPROFILE *profile = &bufProfiles[0];
+        CHAR szProfile[32];
 
-        if (ulParam1 & (MCI_OPEN_ELEMENT | MCI_OPEN_MMIO))
+        if (GetDevParam(pInstance, "PROFILE", szProfile, sizeof(szProfile)))
            {
-           const char *sf2 = getenv("KSOFTSEQ_SF2");
-           struct stat st;
-
-           if (!sf2 || stat(sf2, &st) == -1)
-              sf2 = szDefaultSf2;
-
-           LOG_MSG(1, "sf2 = [%s]", sf2);
-
-           if (ulParam1 & MCI_OPEN_ELEMENT)
-              {
-              strcpy(pInstance->szFileName, pDrvOpenParms->pszElementName);
-
-              pInstance->dec = kmdecOpen(pInstance->szFileName, sf2, &ai);
-              }
-           else /* if (ulParam1 & MCI_OPEN_MMIO) */
-              {
-              HMMIO fd = (HMMIO)pDrvOpenParms->pszElementName;
+           int i;
 
-              pInstance->dec = kmdecOpenFdEx(fd, sf2, &ai, &io);
-              }
+           for (i = 0; i < sizeof(bufProfiles) / sizeof(bufProfiles[0]); i++)
+              if (!stricmp(szProfile, bufProfiles[i].pszName))
+                 break;
 
-           if (!pInstance->dec)
-              {
-              DosCloseMutexSem(pInstance->hmtxAccessSem);
+           if (i < sizeof(bufProfiles) / sizeof(bufProfiles[0]))
+              profile = &bufProfiles[i];
+           else
+              LOG_MSG(2, "unknown profile [%s], default used", szProfile);
+           }
 
-              free(pInstance);
+        ULONG ulNumBuffers = GetDevParamULong(pInstance, "BUFFERS",
+                                              profile->ulNumBuffers);
+        ULONG ulBufferFrames = GetDevParamULong(pInstance, "BUFSIZE",
+                                                profile->ulBufferFrames);
 
-              LOG_RETURN(1, MCIERR_DRIVER_INTERNAL);
-              }
-           }
+        if (ulNumBuffers < 2)
+           ulNumBuffers = 2;
+        if (ulNumBuffers > 32)
+           ulNumBuffers = 32;
 
-        KAISPEC ksWanted, ksObtained;
+        if (ulBufferFrames < 64)
+           ulBufferFrames = 64;
+        if (ulBufferFrames > 65536)
+           ulBufferFrames = 65536;
 
         ksWanted.usDeviceIndex = 0;
         ksWanted.ulType = KAIT_PLAY;
         ksWanted.ulBitsPerSample = BPS_16;
-        ksWanted.ulSamplingRate = ai.sampleRate;
+        ksWanted.ulSamplingRate = pInstance->ai.sampleRate;
         ksWanted.ulDataFormat = 0;
-        ksWanted.ulChannels = ai.channels;
-        ksWanted.ulNumBuffers = 2;
-        ksWanted.ulBufferSize = 4096 * 2 * 2; /* samples * 16bits * 2 ch */
+        ksWanted.ulChannels = pInstance->ai.channels;
+        ksWanted.ulNumBuffers = ulNumBuffers;
+        /* samples * 16bits * channels */
+        ksWanted.ulBufferSize = ulBufferFrames * 2 * pInstance->ai.channels;
         ksWanted.fShareable = ulParam1 & MCI_OPEN_SHAREABLE;
         ksWanted.pfnCallBack = kaiCallback;
         ksWanted.pCallBackData = pInstance;
 
         if (kaiOpen(&ksWanted, &ksObtained, &pInstance->hkai))
            {
-           kmdecClose(pInstance->dec);
-
            DosCloseMutexSem(pInstance->hmtxAccessSem);
 
            free(pInstance);
@@ -308,7 +425,76 @@ RC MCIOpen (FUNCTION_PARM_BLOCK *pFuncBlock)
            LOG_RETURN(1, MCIERR_DRIVER_INTERNAL);
            }
 
-        kaiEnableSoftVolume(pInstance->hkai, TRUE);
+        /* render at the rate of the device, not to be resampled */
+        pInstance->ai.sampleRate = ksObtained.ulSamplingRate;
+        if (ksObtained.ulChannels == 1 || ksObtained.ulChannels == 2)
+           pInstance->ai.channels = ksObtained.ulChannels;
+
+        /* audio queued in the output buffers, rounded, at least 1 ms */
+        ULONG ulBytesPerSec = ksObtained.ulSamplingRate *
+                              ksObtained.ulChannels *
+                              (ksObtained.ulBitsPerSample / 8);
+
+        pInstance->ulBufferTime = ((unsigned long long)ksObtained.ulBufferSize *
+                                   1000 + ulBytesPerSec / 2) / ulBytesPerSec;
+        if (pInstance->ulBufferTime == 0)
+           pInstance->ulBufferTime = 1;
+        pInstance->ulLatency = ksObtained.ulNumBuffers *
+                               pInstance->ulBufferTime;
+
+        LOG_MSG(2, "%ld buffers of %ld bytes obtained, latency = %ld ms",
+                ksObtained.ulNumBuffers, ksObtained.ulBufferSize,
+                pInstance->ulLatency);
+
+        RenderInit(pInstance, ksObtained.ulBufferSize);
+
+        NotifyInit(pInstance);
+
+        if (ulParam1 & (MCI_OPEN_ELEMENT | MCI_OPEN_MMIO))
+           {
+           PSZ pszElementName = pDrvOpenParms->pszElementName;
+
+           if (ulParam1 & MCI_OPEN_ELEMENT)
+              {
+              strcpy(pInstance->szFileName, pDrvOpenParms->pszElementName);
+
+              pszElementName = pInstance->szFileName;
+
+              QueryMidiInfo(pInstance->szFileName, &pInstance->smf);
+              }
+
+           /* open a decoder when needed first */
+           if (pInstance->smf.ulTracks &&
+               GetDevParamULong(pInstance, "LAZYLOAD", 0))
+              pInstance->LazyLoad = TRUE;
+           /* load in background, and notify when done */
+           else if ((ulParam1 & MCI_NOTIFY && !(ulParam1 & MCI_WAIT)) ||
+                    GetDevParamULong(pInstance, "ASYNCLOAD", 0))
+              ulrc = StartLoad(pInstance, MCI_OPEN, ulParam1, pszElementName,
+                               ulParam1 & MCI_NOTIFY ?
+                                  pDrvOpenParms->hwndCallback : 0,
+                               pFuncBlock->usUserParm);
+           else if (!(pInstance->dec = OpenDecoder(pInstance, ulParam1,
+                                                   pszElementName)))
+              ulrc = MCIERR_DRIVER_INTERNAL;
+
+           if (ulrc)
+              {
+              FreeMidiInfo(&pInstance->smf);
+
+              kaiClose(pInstance->hkai);
+
+              NotifyDone(pInstance);
+
+              RenderDone(pInstance);
+
+              DosCloseMutexSem(pInstance->hmtxAccessSem);
+
+              free(pInstance);
+
+              LOG_RETURN(1, ulrc);
+              }
+           }
         }
      }
 
@@ -91,6 +91,10 @@ RC MCIPause(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCIPAUSEVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
+    /* keep the position heard while paused */
+    if (kaiStatus(pInst->hkai) & KAIS_PLAYING)
+        StampPosition(pInst, GetPosition(pInst));
+
     kaiPause(pInst->hkai);
 
     /***************************************************************/
@@ -33,6 +33,7 @@
 /*                                                                          */
 /* ENTRY POINTS:                                                            */
 /*       MCIPlay() - MCI_PLAY message handler                               */
+/*       MCICue() - MCI_CUE message handler                                 */
 /****************************************************************************/
 #define INCL_BASE                    // Base OS2 functions
 #define INCL_DOSSEMAPHORES           // OS2 Semaphore function
@@ -49,6 +50,11 @@
 /***********************************************/
 #define MCIPLAYVALIDFLAGS   (MCI_WAIT | MCI_NOTIFY | MCI_FROM | MCI_TO)
 
+/***********************************************/
+/* MCI_CUE valid flags                         */
+/***********************************************/
+#define MCICUEVALIDFLAGS    (MCI_WAIT | MCI_NOTIFY | MCI_CUE_OUTPUT)
+
 
 /****************************************************************************/
 /*                                                                          */
@@ -92,18 +98,32 @@ RC MCIPlay(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCIPLAYVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
+    if ((rc = LoadLazily(pInst)))
+        LOG_RETURN(pInst->ulDepth--, rc);
+
+    /* render again for the new end position */
+    RenderFlush(pInst, TRUE);
+
     if (ulParam1 & MCI_FROM)
     {
-        ULONG ulFrom = ConvertTime(pParam2->ulFrom, pInst->ulTimeFormat,
+        ULONG ulFrom = ConvertTime(pInst, pParam2->ulFrom, pInst->ulTimeFormat,
                                    MCI_FORMAT_MILLISECONDS);
 
         if (kmdecSeek(pInst->dec, ulFrom, KMDEC_SEEK_SET) == -1)
             LOG_RETURN(pInst->ulDepth--, MCIERR_DRIVER_INTERNAL);
     }
 
+    /* nothing is queued before here */
+    if (!(kaiStatus(pInst->hkai) & (KAIS_PLAYING | KAIS_PAUSED)) ||
+        ulParam1 & MCI_FROM)
+    {
+        pInst->ulStartPosition = kmdecGetPosition(pInst->dec);
+        pInst->Stamped = FALSE;
+    }
+
     if (ulParam1 & MCI_TO)
     {
-        ULONG ulTo = ConvertTime(pParam2->ulTo, pInst->ulTimeFormat,
+        ULONG ulTo = ConvertTime(pInst, pParam2->ulTo, pInst->ulTimeFormat,
                                  MCI_FORMAT_MILLISECONDS);
 
         if (ulTo > kmdecGetDuration(pInst->dec))
@@ -143,3 +163,60 @@ RC MCIPlay(FUNCTION_PARM_BLOCK *pFuncBlock)
 
     LOG_RETURN(pInst->ulDepth--, rc);
 }
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  MCICue                                                 */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  MCI_CUE message processor                             */
+/*                                                                          */
+/* FUNCTION:  Process the MCI_CUE message.  Open a decoder deferred by      */
+/*            LAZYLOAD so that playing can start at once.                   */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      FUNCTION_PARM_BLOCK  *pFuncBlock -- Pointer to function parameter   */
+/*                                          block.                          */
+/* EXIT CODES:                                                              */
+/*      MCIERR_SUCCESS    -- Action completed without error.                */
+/*            .                                                             */
+/*            .                                                             */
+/*            .                                                             */
+/*            .                                                             */
+/*                                                                          */
+/****************************************************************************/
+RC MCICue(FUNCTION_PARM_BLOCK *pFuncBlock)
+{
+    ULONG               rc = MCIERR_SUCCESS;    // Propogated Error Code
+    ULONG               ulParam1;               // Message flags
+    PMCI_GENERIC_PARMS  pParam2;                // Pointer to GENERIC structure
+    PINSTANCE           pInst;                  // Pointer to instance
+
+    /*****************************************************/
+    /* dereference the values from pFuncBlock            */
+    /*****************************************************/
+    ulParam1    = pFuncBlock->ulParam1;
+    pParam2     = pFuncBlock->pParam2;
+    pInst       = pFuncBlock->pInstance;
+
+    LOG_ENTER(++pInst->ulDepth, "ulParam1 = 0x%lx", ulParam1);
+
+    /*******************************************************/
+    /* Validate that we have only valid flags              */
+    /*******************************************************/
+    if (ulParam1 & ~(MCICUEVALIDFLAGS))
+        LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
+
+    rc = LoadLazily(pInst);
+
+    /***************************************************************/
+    /* Send back a notification if the notify flag was on          */
+    /***************************************************************/
+    if ((ulParam1 & MCI_NOTIFY) && !rc)
+        rc = mdmDriverNotify(pInst->usDeviceID,
+                             pParam2->hwndCallback,
+                             MM_MCINOTIFY,
+                             pFuncBlock->usUserParm,
+                             MAKEULONG(MCI_CUE, MCI_NOTIFY_SUCCESSFUL));
+
+    LOG_RETURN(pInst->ulDepth--, rc);
+}
@@ -100,18 +100,20 @@ RC MCISetPositionAdvise(FUNCTION_PARM_BLOCK *pFuncBlock)
     {
         case MCI_SET_POSITION_ADVISE_ON:
         {
-            ULONG ulUnits = ConvertTime(pParam2->ulUnits, pInst->ulTimeFormat,
+            ULONG ulUnits = ConvertTime(pInst, pParam2->ulUnits, pInst->ulTimeFormat,
                                         MCI_FORMAT_MILLISECONDS);
 
             if (ulUnits > 0)
             {
-                int pos = kmdecGetPosition(pInst->dec);
+                int pos = GetPosition(pInst);
 
                 pInst->adviseNotify.hwndCallback = pParam2->hwndCallback;
                 pInst->adviseNotify.ulUnits = ulUnits;
                 pInst->adviseNotify.usUserParm = pParam2->usUserParm;
                 pInst->adviseNotify.ulNext = ((pos + ulUnits - 1) / ulUnits) *
                                              ulUnits;
+
+                NotifyWake(pInst);
             }
             else
                 rc = MCIERR_OUTOFRANGE;
@@ -44,7 +44,7 @@
 #define INCL_BASE
 #define INCL_DOSMODULEMGR
 #define INCL_DOSSEMAPHORES
-
+#define INCL_DOSEXCEPTIONS
 
 #define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
 
@@ -56,6 +56,8 @@
 
 CHAR szLogFile[] = "x:\\MMOS2\\KSOFTSEQ.LOG";
 CHAR szDefaultSf2[] = "x:\\MMOS2\\KSOFTSEQ.SF2";
+CHAR szDefaultSf3[] = "x:\\MMOS2\\KSOFTSEQ.SF3";
+CHAR szSfCacheDir[] = "x:\\MMOS2\\KSFCACHE";
 
 int _CRT_init(void);
 void _CRT_term(void);
@@ -82,6 +84,8 @@ unsigned long _System _DLL_InitTerm(unsigned long hmod, unsigned long flag)
         ulBootDrive += 'A' - 1;
         szLogFile[0] = ulBootDrive;
         szDefaultSf2[0] = ulBootDrive;
+        szDefaultSf3[0] = ulBootDrive;
+        szSfCacheDir[0] = ulBootDrive;
 
         return 1;
 
@@ -140,6 +144,7 @@ ULONG APIENTRY mciDriverEntry(PVOID pInstance,
 {
   ULONG                   ulrc;                // Return Code
   FUNCTION_PARM_BLOCK     ParamBlock;          // Encapsulate Parameters
+  EXCEPTIONREGISTRATIONRECORD xcptRegRec = { NULL, smplmemHandler };
 
   LOG_ENTER(0, "usMessage = %d, ulParam1 = 0x%lx, usUserParm = %d",
             usMessage, ulParam1, usUserParm);
@@ -157,9 +162,28 @@ ULONG APIENTRY mciDriverEntry(PVOID pInstance,
   ParamBlock.ulParam1     = ulParam1;
   ParamBlock.pParam2      = (PVOID)pParam2;
 
+  /* sample data of SoundFont may be committed on access */
+  DosSetExceptionHandler(&xcptRegRec);
+
   if (usMessage != MCI_OPEN)
     DosRequestMutexSem(ParamBlock.pInstance->hmtxAccessSem, -2);
 
+  /***********************************************/
+  /* Wait for loading in background if the      */
+  /* message uses the decoder.                   */
+  /***********************************************/
+  switch (usMessage)
+    {
+    case MCI_CLOSE:
+    case MCI_LOAD:
+    case MCI_PLAY:
+    case MCI_CUE:
+    case MCI_SEEK:
+    case MCI_SET_POSITION_ADVISE:
+      WaitLoad(ParamBlock.pInstance);
+      break;
+    }
+
   /***********************************************/
   /* Switch based on the MCI message.            */
   /* For each message perform error checking and */
@@ -213,6 +237,10 @@ ULONG APIENTRY mciDriverEntry(PVOID pInstance,
       ulrc = MCIResume(&ParamBlock);
      break;
 
+    case MCI_CUE:
+      ulrc = MCICue(&ParamBlock);
+     break;
+
     case MCI_SEEK:
       ulrc = MCISeek(&ParamBlock);
      break;
@@ -238,7 +266,6 @@ ULONG APIENTRY mciDriverEntry(PVOID pInstance,
     case MCI_STEP:
     case MCI_RECORD:
     case MCI_SAVE:
-    case MCI_CUE:
     case MCI_UPDATE:
     case MCI_SET_SYNC_OFFSET:
     case MCI_MASTERAUDIO:
@@ -289,6 +316,8 @@ ULONG APIENTRY mciDriverEntry(PVOID pInstance,
       free(ParamBlock.pInstance);
     }
 
+  DosUnsetExceptionHandler(&xcptRegRec);
+
   LOG_RETURN(0, ulrc);    /* Return to MDM */
 
 } /* mciDriverEntry */
@@ -91,6 +91,10 @@ RC MCIResume(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCIRESUMEVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
+    /* the position heard goes on from now, if it has stopped */
+    if (pInst->Stamped && kaiStatus(pInst->hkai) & KAIS_PAUSED)
+        StampPosition(pInst, pInst->ulStampPos);
+
     kaiResume(pInst->hkai);
 
     /***************************************************************/
@@ -93,11 +93,14 @@ RC MCISeek(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCISEEKVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
+    if ((rc = LoadLazily(pInst)))
+        LOG_RETURN(pInst->ulDepth--, rc);
+
     int duration = kmdecGetDuration(pInst->dec);
     int to;
 
     if (ulParam1 & MCI_TO)
-        to = ConvertTime(pParam2->ulTo, pInst->ulTimeFormat,
+        to = ConvertTime(pInst, pParam2->ulTo, pInst->ulTimeFormat,
                          MCI_FORMAT_MILLISECONDS);
     else if (ulParam1 & MCI_TO_START)
         to = 0;
@@ -108,8 +111,13 @@ RC MCISeek(FUNCTION_PARM_BLOCK *pFuncBlock)
         rc = MCIERR_OUTOFRANGE;
     else
     {
+        RenderFlush(pInst, FALSE);
+
         kmdecSeek(pInst->dec, to, KMDEC_SEEK_SET);
 
+        pInst->ulStartPosition = to;
+        pInst->Stamped = FALSE;
+
         /* reset cutepoint notified flag */
         for (int i = 0; i < MAX_CUE_POINTS; i++)
             pInst->cueNotify[i].Notified = pInst->cueNotify[i].ulCuepoint < to;
@@ -121,6 +129,8 @@ RC MCISeek(FUNCTION_PARM_BLOCK *pFuncBlock)
             pInst->adviseNotify.ulNext = ((to + ulUnits - 1) / ulUnits) *
                                          ulUnits;
         }
+
+        NotifyWake(pInst);
     }
 
     /***************************************************************/
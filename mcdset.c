@@ -102,12 +102,11 @@ RC MCISet(FUNCTION_PARM_BLOCK *pFuncBlock)
     {
         case MCI_SET_AUDIO | MCI_SET_ON:
         case MCI_SET_AUDIO | MCI_SET_OFF:
-            kaiSetSoundState(pInst->hkai, pParam2->ulAudio,
-                             ulParam1 & MCI_SET_ON);
+            GainSetAudio(pInst, pParam2->ulAudio, ulParam1 & MCI_SET_ON);
             break;
 
         case MCI_SET_AUDIO | MCI_SET_VOLUME:
-            kaiSetVolume(pInst->hkai, pParam2->ulAudio, pParam2->ulLevel);
+            GainSetVolume(pInst, pParam2->ulAudio, pParam2->ulLevel);
             break;
 
         case MCI_SET_TIME_FORMAT:
@@ -115,14 +114,23 @@ RC MCISet(FUNCTION_PARM_BLOCK *pFuncBlock)
             {
                 case MCI_FORMAT_MILLISECONDS:
                 case MCI_FORMAT_MMTIME:
-                    pInst->ulTimeFormat = pParam2->ulTimeFormat;
-                    break;
-
                 case MCI_SEQ_SET_SMPTE_24:
                 case MCI_SEQ_SET_SMPTE_25:
                 case MCI_SEQ_SET_SMPTE_30:
                 case MCI_SEQ_SET_SMPTE_30DROP:
+                    pInst->ulTimeFormat = pParam2->ulTimeFormat;
+                    break;
+
                 case MCI_SEQ_SET_SONGPTR:
+                    /* song pointers need the tempo map of a MIDI file */
+                    if (pInst->smf.ulTracks &&
+                        !(pInst->smf.usDivision & 0x8000))
+                    {
+                        pInst->ulTimeFormat = pParam2->ulTimeFormat;
+                        break;
+                    }
+                    /* fall through */
+
                 default:
                     rc = MCIERR_INVALID_TIME_FORMAT_FLAG;
                     break;
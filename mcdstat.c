@@ -112,7 +112,9 @@ RC MCIStatus (FUNCTION_PARM_BLOCK *pFuncBlock)
 
     case MCI_STATUS_MODE:
      ULONG_HIWD(ulrc) = MCI_MODE_RETURN;
-     if (pInstance->Active == TRUE)
+     if (pInstance->ulState == MCD_MODE_LOADING)
+        pStatusParms->ulReturn = MCI_MODE_NOT_READY;
+     else if (pInstance->Active == TRUE)
         {
         ULONG ulStatus = kaiStatus(pInstance->hkai);
         if (ulStatus & KAIS_PAUSED)
@@ -128,19 +130,49 @@ RC MCIStatus (FUNCTION_PARM_BLOCK *pFuncBlock)
 
     case MCI_STATUS_VOLUME:
      ULONG_HIWD(ulrc) = MCI_INTEGER_RETURNED;
-     pStatusParms->ulReturn = MAKEULONG(kaiGetVolume(pInstance->hkai, MCI_STATUS_AUDIO_LEFT),
-                                        kaiGetVolume(pInstance->hkai, MCI_STATUS_AUDIO_RIGHT));
+     pStatusParms->ulReturn = MAKEULONG(pInstance->aulVolume[0],
+                                        pInstance->aulVolume[1]);
      break;
 
     case MCI_STATUS_LENGTH:
      ULONG_HIWD(ulrc) = MCI_INTEGER_RETURNED;
-     pStatusParms->ulReturn =
-        ConvertTime(kmdecGetDuration(pInstance->dec), MCI_FORMAT_MILLISECONDS, pInstance->ulTimeFormat);
+     WaitLoad(pInstance);
+     if (pInstance->LazyLoad)
+        pStatusParms->ulReturn =
+           ConvertTime(pInstance, pInstance->smf.ulDuration, MCI_FORMAT_MILLISECONDS, pInstance->ulTimeFormat);
+     else if (!pInstance->dec)
+        ulrc = pInstance->ulLoadError;
+     else
+        pStatusParms->ulReturn =
+           ConvertTime(pInstance, kmdecGetDuration(pInstance->dec), MCI_FORMAT_MILLISECONDS, pInstance->ulTimeFormat);
+     break;
+
+    case MCI_STATUS_NUMBER_OF_TRACKS:
+     if (!pInstance->smf.ulTracks)
+        {
+        ulrc = MCIERR_UNSUPPORTED_FLAG;
+        break;
+        }
+     ULONG_HIWD(ulrc) = MCI_INTEGER_RETURNED;
+     pStatusParms->ulReturn = pInstance->smf.ulTracks;
+     break;
+
+    case MCI_SEQ_STATUS_TEMPO:
+     if (!pInstance->smf.ulTracks)
+        {
+        ulrc = MCIERR_UNSUPPORTED_FLAG;
+        break;
+        }
+     /* beats per minute */
+     ULONG_HIWD(ulrc) = MCI_INTEGER_RETURNED;
+     pStatusParms->ulReturn = (60000000 + pInstance->smf.ulTempo / 2) /
+                              pInstance->smf.ulTempo;
      break;
 
     case MCI_STATUS_READY:
      ULONG_HIWD(ulrc) = MCI_TRUE_FALSE_RETURN;
-     if (pInstance->Active == TRUE)
+     if (pInstance->Active == TRUE &&
+         pInstance->ulState != MCD_MODE_LOADING)
         pStatusParms->ulReturn = MCI_TRUE;
      else
         pStatusParms->ulReturn = MCI_FALSE;
@@ -148,8 +180,9 @@ RC MCIStatus (FUNCTION_PARM_BLOCK *pFuncBlock)
 
     case MCI_STATUS_POSITION:
      ULONG_HIWD(ulrc) = MCI_INTEGER_RETURNED;
+     WaitLoad(pInstance);
      pStatusParms->ulReturn =
-         ConvertTime(kmdecGetPosition(pInstance->dec), MCI_FORMAT_MILLISECONDS, pInstance->ulTimeFormat);
+         ConvertTime(pInstance, GetPosition(pInstance), MCI_FORMAT_MILLISECONDS, pInstance->ulTimeFormat);
      break;
 
     case MCI_STATUS_MEDIA_PRESENT:
@@ -162,7 +195,6 @@ RC MCIStatus (FUNCTION_PARM_BLOCK *pFuncBlock)
     case MCI_SEQ_STATUS_OFFSET:
     case MCI_SEQ_STATUS_PORT:
     case MCI_SEQ_STATUS_SLAVE:
-    case MCI_SEQ_STATUS_TEMPO:
     default:
       ulrc = MCIERR_UNSUPPORTED_FLAG;
       break;
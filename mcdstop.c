@@ -91,12 +91,23 @@ RC MCIStop(FUNCTION_PARM_BLOCK *pFuncBlock)
     if (ulParam1 & ~(MCISTOPVALIDFLAGS))
         LOG_RETURN(pInst->ulDepth--, MCIERR_INVALID_FLAG);
 
+    /* the queued audio is discarded, continue from the position heard */
+    ULONG ulPos = GetPosition(pInst);
+
     pInst->AvoidDeadLock = TRUE;
 
     kaiStop(pInst->hkai);
 
     pInst->AvoidDeadLock = FALSE;
 
+    RenderFlush(pInst, FALSE);
+
+    if (pInst->dec && ulPos != kmdecGetPosition(pInst->dec))
+        kmdecSeek(pInst->dec, ulPos, KMDEC_SEEK_SET);
+
+    pInst->ulStartPosition = ulPos;
+    pInst->Stamped = FALSE;
+
     /***************************************************************/
     /* Send back a notification if the notify flag was on          */
     /***************************************************************/
@@ -66,6 +66,87 @@ typedef struct {
     USHORT  usUserParm;
 } ADVISENOTIFY;
 
+typedef struct {
+    HWND    hwndCallback;
+    USHORT  usMessage;                  /* MCI_OPEN or MCI_LOAD */
+    USHORT  usUserParm;
+    ULONG   ulParam1;                   /* MCI_OPEN_ELEMENT or MCI_OPEN_MMIO */
+    PSZ     pszElementName;
+    ULONG   ulSavedState;
+} LOADNOTIFY;
+
+#define SMF_TEMPO_DEFAULT   500000      /* microseconds per quarter note */
+
+typedef struct {
+    ULONG   ulTick;
+    ULONG   ulTempo;                    /* microseconds per quarter note */
+    ULONG   ulMs;                       /* time of ulTick */
+} SMFTEMPO;
+
+typedef struct {
+    ULONG   ulStart;                    /* last note released, 0 if none */
+    ULONG   ulEnd;                      /* next note started */
+} SMFSILENCE;                           /* in ms */
+
+typedef struct {
+    ULONG   ulFormat;                   /* 0, 1 or 2 */
+    ULONG   ulTracks;
+    USHORT  usDivision;                 /* ticks per quarter note or SMPTE */
+    ULONG   ulTempo;                    /* first tempo in microseconds */
+    ULONG   ulDuration;                 /* in ms */
+    ULONG   ulTempos;
+    SMFTEMPO *pTempos;                  /* tempo map */
+    ULONG   ulSilences;
+    SMFSILENCE *pSilences;              /* spans without notes */
+} SMFINFO;
+
+typedef struct {
+    PBYTE   pb;                         /* NULL if not used */
+    ULONG   ulSize;
+    ULONG   ulPos;
+} MEMSTREAM;
+
+#define RENDER_MAX_BLOCKS   8
+
+typedef struct {
+    PBYTE   pb;                         /* NULL if not used */
+    ULONG   ulBlockSize;
+    ULONG   ulMaxBlocks;
+    ULONG   aulStart[RENDER_MAX_BLOCKS];    /* decoder position before */
+    ULONG   aulPos[RENDER_MAX_BLOCKS];      /* decoder position after */
+    ULONG   aulLen[RENDER_MAX_BLOCKS];      /* bytes in a block */
+    ULONG   ulHead;                     /* block to be played next */
+    ULONG   ulCount;                    /* blocks rendered ahead */
+    ULONG   ulAhead;                    /* blocks to render ahead */
+    ULONG   ulStable;                   /* time with enough headroom in ms */
+    BOOL    End;                        /* True if the last block is rendered */
+    BOOL volatile Quit;
+    TID     tid;
+    HMTX    hmtx;                       /* for blocks */
+    HMTX    hmtxDecode;                 /* held while decoding a block */
+    HEV     hev;                        /* posted to render */
+    ULONG   ulSilenceTail;              /* 0 not to skip silence, in ms */
+    ULONG   ulSilenceRem;               /* 1/1000 frames filled ahead */
+    BOOL    Silent;                     /* True if silence was filled last */
+} RENDERAHEAD;
+
+typedef struct {
+    TID     tid;                        /* 0 if not running */
+    HEV     hev;                        /* posted to check positions */
+    BOOL volatile Quit;
+} NOTIFYTHREAD;
+
+#define MMIO_BUF_SIZE   ( 64 * 1024 )
+
+typedef struct {
+    HMMIO   hmmio;
+    PBYTE   pb;                         /* NULL if not used */
+    ULONG   ulBase;                     /* offset of buffer, aligned */
+    ULONG   ulLen;                      /* valid bytes in buffer */
+    ULONG   ulPos;                      /* offset to read next */
+    ULONG   ulFilePos;                  /* offset of MMIO handle */
+} MMIOSTREAM;
+
 
 /********************************************************************
 *   This Structure defines the data items that are needed to be
@@ -83,12 +164,21 @@ typedef struct _Instance {
     ULONG     ulSyncOffset;              /* Synchronizatn offst  */
     ULONG     ulVolume;                  /* Instance Volume      */
     ULONG     ulMasterVolume;            /* Master Volume        */
+    ULONG     aulVolume[2];              /* Left and right volume in % */
+    BOOL      AudioOn[2];                /* True if left/right audio is on */
+    ULONG     ulDitherSeed;              /* Random seed for dither */
+    float     afGain[2];                 /* Gain at the end of last block */
     ULONG     ulTimeFormat;              /* Current Time Format  */
     ULONG     ulSpeedFormat;             /* Current SpeedFormat  */
     ULONG     ulState;                   /* Current instance state */
     ULONG     ulMode;                    /* Current instance state */
     ULONG     ulCurrentPosition;         /* Current position     */
     ULONG     ulStartPosition;           /* Start position       */
+    ULONG     ulLatency;                 /* Output latency in ms */
+    ULONG     ulBufferTime;              /* Output buffer in ms  */
+    BOOL      Stamped;                   /* True if position is stamped */
+    ULONG     ulStampPos;                /* Position heard at ulStampTime */
+    ULONG     ulStampTime;               /* Timer in ms            */
     ULONG     ulEndPosition;             /* End   position       */
     BOOL      Active;                    /* True if instance is active */
     BOOL      Speaker;                   /* True if speaker should be on */
@@ -101,9 +191,19 @@ typedef struct _Instance {
     ULONG     ulTolerance;
     ULONG     ulSavedStatus;
     PKMDEC    dec;
+    KMDECAUDIOINFO ai;                   /* format of decoder */
+    TID       tidLoad;                   /* thread loading in background */
+    LOADNOTIFY loadNotify;
+    ULONG     ulLoadError;               /* error while no decoder is opened */
+    SMFINFO   smf;                       /* ulTracks is 0 if not parsed */
+    BOOL      LazyLoad;                  /* True if decoder is not opened yet */
+    MEMSTREAM flat;                      /* flattened MIDI for decoder */
+    MMIOSTREAM mmio;                     /* buffered MMIO for decoder */
+    RENDERAHEAD render;                  /* blocks decoded ahead */
     PLAYNOTIFY playNotify;
     CUENOTIFY cueNotify[MAX_CUE_POINTS];
     ADVISENOTIFY adviseNotify;
+    NOTIFYTHREAD notifier;               /* thread notifying positions */
     BOOL volatile AvoidDeadLock;
     ULONG     ulDepth;
     } INSTANCE;         /* Audio MCD MCI Instance Block */
@@ -159,7 +259,8 @@ VOID  GetINIInstallName(PINSTANCE pInstance);
 VOID  GetDeviceInfo(PINSTANCE pInstance);
 VOID  QMAudio(PINSTANCE pInstance);
 RC    MCIStatus (FUNCTION_PARM_BLOCK *pFuncBlock);
-ULONG ConvertTime(ULONG ulTime, ULONG ulCurrentFormat, ULONG ulNewFormat);
+ULONG ConvertTime(PINSTANCE pInstance, ULONG ulTime, ULONG ulCurrentFormat,
+                  ULONG ulNewFormat);
 RC    MCIInfo   (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIDRVRestore (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIDRVSave (FUNCTION_PARM_BLOCK *pFuncBlock);
@@ -167,12 +268,64 @@ RC    MCICaps (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCILoad (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIPause (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIPlay (FUNCTION_PARM_BLOCK *pFuncBlock);
+RC    MCICue (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIResume (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCISeek (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCISet (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCISetCuePoint (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCISetPositionAdvise (FUNCTION_PARM_BLOCK *pFuncBlock);
 RC    MCIStop (FUNCTION_PARM_BLOCK *pFuncBlock);
+BOOL  GetDevParam(PINSTANCE pInstance, PCSZ pszName, PSZ pszValue, ULONG ulSize);
+ULONG GetDevParamULong(PINSTANCE pInstance, PCSZ pszName, ULONG ulDefault);
+ULONG AudiblePosition(PINSTANCE pInstance, ULONG ulPos);
+ULONG GetPosition(PINSTANCE pInstance);
+VOID  StampPosition(PINSTANCE pInstance, ULONG ulPos);
+ULONG QueryTimerMs(VOID);
+VOID  RenderInit(PINSTANCE pInstance, ULONG ulBlockSize);
+VOID  RenderDone(PINSTANCE pInstance);
+VOID  RenderFlush(PINSTANCE pInstance, BOOL fRewind);
+int   RenderRead(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize,
+                 PULONG pulPos);
+int   RenderWait(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize,
+                 PULONG pulPos);
+VOID  RenderAdapt(PINSTANCE pInstance, ULONG ulTime, BOOL fUnderrun);
+ULONG RenderSize(PINSTANCE pInstance, ULONG ulSize, int pos);
+int   RenderDecode(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize);
+VOID  NotifyInit(PINSTANCE pInstance);
+VOID  NotifyDone(PINSTANCE pInstance);
+BOOL  NotifyWake(PINSTANCE pInstance);
+VOID  NotifyPosition(PINSTANCE pInstance, ULONG ulPos);
+VOID  GainSetVolume(PINSTANCE pInstance, ULONG ulAudio, ULONG ulLevel);
+VOID  GainSetAudio(PINSTANCE pInstance, ULONG ulAudio, BOOL fOn);
+VOID  GainApply(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize);
+VOID  GetSoundFont(PINSTANCE pInstance, PSZ pszSf, ULONG ulSize);
+BOOL  QuerySampleChunk(PCSZ pszSf, PLONG plPos, PULONG pulSize);
+VOID  PruneCache(PINSTANCE pInstance, PCSZ pszKeep, ULONG ulAdded);
+PKMDEC OpenDecoder(PINSTANCE pInstance, ULONG ulParam1, PSZ pszElementName);
+VOID  CloseDecoder(PINSTANCE pInstance);
+RC    StartLoad(PINSTANCE pInstance, USHORT usMessage, ULONG ulParam1,
+                PSZ pszElementName, HWND hwndCallback, USHORT usUserParm);
+VOID  WaitLoad(PINSTANCE pInstance);
+RC    LoadLazily(PINSTANCE pInstance);
+BOOL  QueryMidiInfo(PCSZ pszFile, SMFINFO *pInfo);
+VOID  FreeMidiInfo(SMFINFO *pInfo);
+PBYTE FlattenMidi(PCSZ pszFile, SMFINFO *pInfo, ULONG ulThinMs,
+                  PULONG pulSize);
+ULONG MidiTicksToMs(SMFINFO *pInfo, ULONG ulTick);
+ULONG MidiMsToTicks(SMFINFO *pInfo, ULONG ulMs);
+ULONG MidiSilenceEnd(SMFINFO *pInfo, ULONG ulMs, ULONG ulTail);
+
+/***********************************************/
+/* Sample memory prototypes                    */
+/***********************************************/
+VOID  smplmemExpect(PINSTANCE pInstance, PCSZ pszSf);
+VOID  smplmemExpectDone(VOID);
+PVOID smplmemAlloc(ULONG ulHeader, ULONG ulSize);
+VOID  smplmemFree(PVOID p);
+ULONG APIENTRY smplmemHandler(PEXCEPTIONREPORTRECORD pReport,
+                              PEXCEPTIONREGISTRATIONRECORD pRegRec,
+                              PCONTEXTRECORD pContext,
+                              PVOID pDispatcherContext);
 
 /***********************************************/
 /* Logging macros                              */
@@ -180,6 +333,8 @@ RC    MCIStop (FUNCTION_PARM_BLOCK *pFuncBlock);
 
 extern CHAR szLogFile[];
 extern CHAR szDefaultSf2[];
+extern CHAR szDefaultSf3[];
+extern CHAR szSfCacheDir[];
 
 #define LOG_ENTER(depth, format, ...) \
         kloggerFile((depth), szLogFile, "%s: entered, " format, \
@@ -0,0 +1,257 @@
+/****************************************************************************
+**
+** notify.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/****************************************************************************/
+/*                                                                          */
+/* SOURCE FILE NAME:  NOTIFY.C                                              */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  CUE POINT AND POSITION ADVISE NOTIFICATION            */
+/*                                                                          */
+/* FUNCTION:  This file contains routines to notify cue points and position */
+/*            advise when they are heard, not when the buffer containing    */
+/*            them is decoded.  A thread sleeps until the next one by the   */
+/*            position extrapolated from the last buffer played, and is     */
+/*            woken up by the KAI callback for every buffer.  It notifies   */
+/*            only while playing, so nothing is notified while paused or    */
+/*            stopped, and a seek is followed from the new position.        */
+/*                                                                          */
+/* ENTRY POINTS:                                                            */
+/*       NotifyInit() - Start notifying positions                           */
+/*       NotifyDone() - Stop notifying positions                            */
+/*       NotifyWake() - Check positions to notify again                     */
+/*       NotifyPosition() - Notify positions reached                        */
+/****************************************************************************/
+#define INCL_BASE                    // Base OS2 functions
+#define INCL_DOSSEMAPHORES           // OS2 Semaphore function
+#define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
+
+#include <os2.h>                     // OS2 defines.
+#include <string.h>                  // C string functions
+#include <os2me.h>                   // MME includes files.
+#include <stdlib.h>                  // Math functions
+#include "mcdtemp.h"                 // Function Prototypes.
+
+#include <process.h>                 // _beginthread()
+
+#define NOTIFY_STACK_SIZE   ( 64 * 1024 )
+
+/* next position to notify after pos, 0 if none */
+static ULONG nextPosition(PINSTANCE pInst, ULONG pos)
+{
+    ULONG ulNext = 0;
+
+    for (int i = 0; i < MAX_CUE_POINTS; i++)
+    {
+        CUENOTIFY *notify = &pInst->cueNotify[i];
+
+        if (notify->On && !notify->Notified &&
+            (!ulNext || notify->ulCuepoint < ulNext))
+            ulNext = notify->ulCuepoint;
+    }
+
+    if (pInst->adviseNotify.ulUnits &&
+        (!ulNext || pInst->adviseNotify.ulNext < ulNext))
+        ulNext = pInst->adviseNotify.ulNext;
+
+    return ulNext > pos ? ulNext : 0;
+}
+
+/* thread notifying positions on time */
+static void notifyThread(void *arg)
+{
+    PINSTANCE pInst = arg;
+    NOTIFYTHREAD *nt = &pInst->notifier;
+    ULONG ulPosts;
+
+    /* notify as soon as the position is heard */
+    DosSetPriority(PRTYS_THREAD, PRTYC_TIMECRITICAL, 0, 0);
+
+    while (!nt->Quit)
+    {
+        ULONG ulTimeout = SEM_INDEFINITE_WAIT;
+        ULONG rc = ERROR_TIMEOUT;
+
+        /* give up the instance if quitting */
+        while (!nt->Quit && rc == ERROR_TIMEOUT)
+            rc = DosRequestMutexSem(pInst->hmtxAccessSem, 100);
+
+        if (rc)
+            continue;
+
+        ULONG ulStatus = kaiStatus(pInst->hkai);
+
+        if (ulStatus & KAIS_PLAYING && !(ulStatus & KAIS_PAUSED))
+        {
+            ULONG pos = GetPosition(pInst);
+            ULONG ulNext;
+
+            NotifyPosition(pInst, pos);
+
+            /* sleep until the next one, or the next buffer */
+            if ((ulNext = nextPosition(pInst, pos)) != 0)
+                ulTimeout = ulNext - pos;
+        }
+
+        DosReleaseMutexSem(pInst->hmtxAccessSem);
+
+        DosWaitEventSem(nt->hev, ulTimeout);
+        DosResetEventSem(nt->hev, &ulPosts);
+    }
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  NotifyInit                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Start notifying positions                             */
+/*                                                                          */
+/* FUNCTION:  Start a thread notifying cue points and position advise.      */
+/*            Without it, the KAI callback notifies them per buffer.        */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*                                                                          */
+/****************************************************************************/
+VOID NotifyInit(PINSTANCE pInstance)
+{
+    NOTIFYTHREAD *nt = &pInstance->notifier;
+
+    memset(nt, 0, sizeof(*nt));
+
+    if (DosCreateEventSem(NULL, &nt->hev, 0, FALSE))
+        return;
+
+    int tid = _beginthread(notifyThread, NULL, NOTIFY_STACK_SIZE, pInstance);
+
+    if (tid == -1)
+    {
+        DosCloseEventSem(nt->hev);
+        nt->hev = NULLHANDLE;
+
+        return;
+    }
+
+    nt->tid = tid;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  NotifyDone                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Stop notifying positions                              */
+/*                                                                          */
+/* FUNCTION:  Stop the thread started by NotifyInit().                      */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*                                                                          */
+/****************************************************************************/
+VOID NotifyDone(PINSTANCE pInstance)
+{
+    NOTIFYTHREAD *nt = &pInstance->notifier;
+
+    if (!nt->tid)
+        return;
+
+    nt->Quit = TRUE;
+    DosPostEventSem(nt->hev);
+    DosWaitThread(&nt->tid, DCWW_WAIT);
+
+    DosCloseEventSem(nt->hev);
+
+    memset(nt, 0, sizeof(*nt));
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  NotifyWake                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Check positions to notify again                       */
+/*                                                                          */
+/* FUNCTION:  Wake up the thread notifying positions, because the position  */
+/*            has been stamped, or the positions to notify have changed.    */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      TRUE if the thread is running, FALSE otherwise.                     */
+/*                                                                          */
+/****************************************************************************/
+BOOL NotifyWake(PINSTANCE pInstance)
+{
+    if (!pInstance->notifier.tid)
+        return FALSE;
+
+    DosPostEventSem(pInstance->notifier.hev);
+
+    return TRUE;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  NotifyPosition                                         */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Notify positions reached                              */
+/*                                                                          */
+/* FUNCTION:  Notify cue points and position advise not after the position. */
+/*            The caller should own the instance.                           */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      ULONG      ulPos       -- Position reached in ms.                   */
+/*                                                                          */
+/****************************************************************************/
+VOID NotifyPosition(PINSTANCE pInstance, ULONG ulPos)
+{
+    for (int i = 0; i < MAX_CUE_POINTS; i++)
+    {
+        CUENOTIFY *notify = &pInstance->cueNotify[i];
+
+        if (notify->On && !notify->Notified && notify->ulCuepoint <= ulPos)
+        {
+            notify->Notified = TRUE;
+
+            mdmDriverNotify(pInstance->usDeviceID,
+                            notify->hwndCallback,
+                            MM_MCICUEPOINT, notify->usUserParm,
+                            MSECTOMM(notify->ulCuepoint));
+        }
+    }
+
+    ADVISENOTIFY *advise = &pInstance->adviseNotify;
+
+    if (advise->ulUnits)
+    {
+        while (advise->ulNext <= ulPos)
+        {
+            mdmDriverNotify(pInstance->usDeviceID,
+                            advise->hwndCallback,
+                            MM_MCIPOSITIONCHANGE,
+                            advise->usUserParm,
+                            MSECTOMM(advise->ulNext));
+
+            advise->ulNext += advise->ulUnits;
+        }
+    }
+}
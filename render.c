@@ -0,0 +1,598 @@
+/****************************************************************************
+**
+** render.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/****************************************************************************/
+/*                                                                          */
+/* SOURCE FILE NAME:  RENDER.C                                              */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  ADAPTIVE RENDER-AHEAD                                 */
+/*                                                                          */
+/* FUNCTION:  This file contains routines to decode MIDI ahead of the KAI   */
+/*            callback in a thread.  The time to decode a buffer is watched */
+/*            against the time to play it.  Blocks are decoded ahead when   */
+/*            the headroom gets thin or the callback has to wait, and less  */
+/*            blocks are decoded ahead again after a stable period, so the  */
+/*            latency is paid only while needed.  Spans without notes are   */
+/*            filled with silence instead of being decoded.  A block is     */
+/*            decoded under hmtxDecode without holding the instance, so     */
+/*            the KAI callback and MCI messages do not wait for decoding    */
+/*            unless they need the decoder.                                 */
+/*                                                                          */
+/* ENTRY POINTS:                                                            */
+/*       RenderInit() - Start rendering ahead                               */
+/*       RenderDone() - Stop rendering ahead                                */
+/*       RenderFlush() - Discard blocks rendered ahead                      */
+/*       RenderRead() - Read a block rendered ahead                         */
+/*       RenderWait() - Wait for a block, or decode it                      */
+/*       RenderAdapt() - Adapt blocks to render ahead                       */
+/*       RenderSize() - Limit the size to decode to the end position        */
+/*       RenderDecode() - Decode or fill silence                            */
+/****************************************************************************/
+#define INCL_BASE                    // Base OS2 functions
+#define INCL_DOSSEMAPHORES           // OS2 Semaphore function
+#define INCL_DOSEXCEPTIONS           // OS2 Exception function
+#define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
+
+#include <os2.h>                     // OS2 defines.
+#include <string.h>                  // C string functions
+#include <os2me.h>                   // MME includes files.
+#include <stdlib.h>                  // Math functions
+#include "mcdtemp.h"                 // Function Prototypes.
+
+#include <process.h>                 // _beginthread()
+
+#define RENDER_STACK_SIZE   ( 1024 * 1024 )
+
+/* time to stay stable before rendering less ahead in ms */
+#define RENDER_STABLE_TIME  5000
+
+/* frames to fade out before filling silence */
+#define RENDER_FADE_FRAMES  256
+
+/* fade out interleaved 16-bit samples linearly */
+static VOID fadeOut(PSHORT ps, ULONG ulFrames, ULONG ulChannels)
+{
+    for (ULONG i = 0; i < ulFrames; i++)
+    {
+        ULONG ulLeft = ulFrames - 1 - i;
+
+        for (ULONG c = 0; c < ulChannels; c++, ps++)
+            *ps = (LONG)*ps * (LONG)ulLeft / (LONG)ulFrames;
+    }
+}
+
+/* decode one block at the tail */
+static BOOL renderBlock(PINSTANCE pInst)
+{
+    RENDERAHEAD *ra = &pInst->render;
+    ULONG ulTail = (ra->ulHead + ra->ulCount) % ra->ulMaxBlocks;
+    PBYTE pb = ra->pb + ulTail * ra->ulBlockSize;
+    int pos = kmdecGetPosition(pInst->dec);
+    ULONG ulSize = RenderSize(pInst, ra->ulBlockSize, pos);
+    ULONG ulStart = QueryTimerMs();
+    int written = ulSize ? RenderDecode(pInst, pb, ulSize) : 0;
+
+    if (written < 0)
+        written = 0;
+
+    RenderAdapt(pInst, QueryTimerMs() - ulStart, FALSE);
+
+    DosRequestMutexSem(ra->hmtx, SEM_INDEFINITE_WAIT);
+
+    ra->aulStart[ulTail] = pos;
+    ra->aulPos[ulTail] = kmdecGetPosition(pInst->dec);
+    ra->aulLen[ulTail] = written;
+    ra->ulCount++;
+
+    DosReleaseMutexSem(ra->hmtx);
+
+    /* nothing more after the last block */
+    return written == ra->ulBlockSize;
+}
+
+/* thread rendering ahead */
+static void renderThread(void *arg)
+{
+    PINSTANCE pInst = arg;
+    RENDERAHEAD *ra = &pInst->render;
+    EXCEPTIONREGISTRATIONRECORD xcptRegRec = { NULL, smplmemHandler };
+    ULONG ulPosts;
+
+    /* sample data of SoundFont may be committed on access */
+    DosSetExceptionHandler(&xcptRegRec);
+
+    /* feed the KAI callback as urgently as it runs */
+    DosSetPriority(PRTYS_THREAD, PRTYC_TIMECRITICAL, 0, 0);
+
+    while (!ra->Quit)
+    {
+        DosWaitEventSem(ra->hev, SEM_INDEFINITE_WAIT);
+        DosResetEventSem(ra->hev, &ulPosts);
+
+        while (!ra->Quit && !ra->End && ra->ulCount < ra->ulAhead)
+        {
+            ULONG rc = ERROR_TIMEOUT;
+
+            /* give up the instance if quitting */
+            while (!ra->Quit && rc == ERROR_TIMEOUT)
+                rc = DosRequestMutexSem(pInst->hmtxAccessSem, 100);
+
+            if (rc)
+                break;
+
+            /*******************************************************/
+            /* check again, the instance may have changed          */
+            /* meanwhile.  Not to move the decoder beyond the      */
+            /* position heard, render only while playing.          */
+            /*******************************************************/
+            BOOL fRender = pInst->dec && !pInst->LazyLoad &&
+                           kaiStatus(pInst->hkai) & KAIS_PLAYING &&
+                           !ra->End && ra->ulCount < ra->ulAhead;
+
+            /*******************************************************/
+            /* decode without the instance.  Whoever changes the   */
+            /* decoder waits for hmtxDecode in RenderFlush().      */
+            /*******************************************************/
+            if (fRender)
+                DosRequestMutexSem(ra->hmtxDecode, SEM_INDEFINITE_WAIT);
+
+            DosReleaseMutexSem(pInst->hmtxAccessSem);
+
+            /* wait to be posted again */
+            if (!fRender)
+                break;
+
+            ra->End = !renderBlock(pInst);
+
+            DosReleaseMutexSem(ra->hmtxDecode);
+        }
+    }
+
+    DosUnsetExceptionHandler(&xcptRegRec);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderInit                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Start rendering ahead                                 */
+/*                                                                          */
+/* FUNCTION:  Allocate blocks of the output buffer size, and start a thread */
+/*            rendering ahead.  Up to RENDERAHEAD blocks are used, and      */
+/*            RENDERAHEAD=0 disables it.  Silence is skipped SILENCE ms     */
+/*            after the last note, and SILENCE=0 disables it.               */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      ULONG      ulBlockSize -- Size of an output buffer.                 */
+/*                                                                          */
+/****************************************************************************/
+VOID RenderInit(PINSTANCE pInstance, ULONG ulBlockSize)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+    ULONG ulMaxBlocks = GetDevParamULong(pInstance, "RENDERAHEAD", 4);
+
+    memset(ra, 0, sizeof(*ra));
+
+    ra->ulSilenceTail = GetDevParamULong(pInstance, "SILENCE", 3000);
+
+    if (!ulMaxBlocks)
+        return;
+
+    if (ulMaxBlocks > RENDER_MAX_BLOCKS)
+        ulMaxBlocks = RENDER_MAX_BLOCKS;
+
+    if (!(ra->pb = malloc(ulMaxBlocks * ulBlockSize)))
+        return;
+
+    ra->ulBlockSize = ulBlockSize;
+    ra->ulMaxBlocks = ulMaxBlocks;
+
+    DosCreateMutexSem(NULL, &ra->hmtx, 0, FALSE);
+    DosCreateMutexSem(NULL, &ra->hmtxDecode, 0, FALSE);
+    DosCreateEventSem(NULL, &ra->hev, 0, FALSE);
+
+    int tid = _beginthread(renderThread, NULL, RENDER_STACK_SIZE, pInstance);
+
+    if (tid == -1)
+    {
+        DosCloseEventSem(ra->hev);
+        DosCloseMutexSem(ra->hmtxDecode);
+        DosCloseMutexSem(ra->hmtx);
+
+        free(ra->pb);
+        ra->pb = NULL;
+
+        return;
+    }
+
+    ra->tid = tid;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderDone                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Stop rendering ahead                                  */
+/*                                                                          */
+/* FUNCTION:  Stop the thread rendering ahead, and free blocks.             */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*                                                                          */
+/****************************************************************************/
+VOID RenderDone(PINSTANCE pInstance)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+
+    if (!ra->pb)
+        return;
+
+    ra->Quit = TRUE;
+    DosPostEventSem(ra->hev);
+    DosWaitThread(&ra->tid, DCWW_WAIT);
+
+    DosCloseEventSem(ra->hev);
+    DosCloseMutexSem(ra->hmtxDecode);
+    DosCloseMutexSem(ra->hmtx);
+
+    free(ra->pb);
+    ra->pb = NULL;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderFlush                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Discard blocks rendered ahead                         */
+/*                                                                          */
+/* FUNCTION:  Discard blocks rendered ahead after the block being rendered  */
+/*            is done, so that the caller may use the decoder.  The caller  */
+/*            should own the instance.                                      */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      BOOL       fRewind     -- TRUE to move the decoder back to the      */
+/*                                start of the blocks discarded.            */
+/*                                                                          */
+/****************************************************************************/
+VOID RenderFlush(PINSTANCE pInstance, BOOL fRewind)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+
+    if (!ra->pb)
+    {
+        ra->ulSilenceRem = 0;
+        ra->Silent = FALSE;
+
+        return;
+    }
+
+    DosRequestMutexSem(ra->hmtxDecode, SEM_INDEFINITE_WAIT);
+    DosRequestMutexSem(ra->hmtx, SEM_INDEFINITE_WAIT);
+
+    if (fRewind && ra->ulCount && pInstance->dec)
+        kmdecSeek(pInstance->dec, ra->aulStart[ra->ulHead], KMDEC_SEEK_SET);
+
+    ra->ulCount = 0;
+    ra->End = FALSE;
+    ra->ulSilenceRem = 0;
+    ra->Silent = FALSE;
+
+    DosReleaseMutexSem(ra->hmtx);
+    DosReleaseMutexSem(ra->hmtxDecode);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderRead                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Read a block rendered ahead                           */
+/*                                                                          */
+/* FUNCTION:  Copy the oldest block rendered ahead to the buffer.  This     */
+/*            does not wait for the instance.                               */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      PVOID      pBuffer     -- Buffer to fill.                           */
+/*      ULONG      ulSize      -- Size of pBuffer.                          */
+/*      PULONG     pulPos      -- Decoder position after the block.         */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      Bytes copied, or -1 if no block is rendered ahead.                  */
+/*                                                                          */
+/****************************************************************************/
+int RenderRead(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize,
+               PULONG pulPos)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+    int len = -1;
+
+    if (!ra->pb)
+        return -1;
+
+    DosRequestMutexSem(ra->hmtx, SEM_INDEFINITE_WAIT);
+
+    if (ra->ulCount)
+    {
+        len = ra->aulLen[ra->ulHead];
+        if (len > ulSize)
+            len = ulSize;
+
+        memcpy(pBuffer, ra->pb + ra->ulHead * ra->ulBlockSize, len);
+        *pulPos = ra->aulPos[ra->ulHead];
+
+        ra->ulHead = (ra->ulHead + 1) % ra->ulMaxBlocks;
+        ra->ulCount--;
+
+        if (!ra->End)
+            DosPostEventSem(ra->hev);
+    }
+
+    DosReleaseMutexSem(ra->hmtx);
+
+    return len;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderWait                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Wait for a block, or decode it                        */
+/*                                                                          */
+/* FUNCTION:  Wait for the block being rendered ahead, if any, and copy it  */
+/*            to the buffer.  If no block is rendered ahead, decode to the  */
+/*            buffer directly.  The caller should own the instance, or the  */
+/*            thread owning it should be waiting for KAI.                   */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      PVOID      pBuffer     -- Buffer to fill.                           */
+/*      ULONG      ulSize      -- Size of pBuffer.                          */
+/*      PULONG     pulPos      -- Decoder position after the buffer.        */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      Bytes filled, or -1 on error.                                       */
+/*                                                                          */
+/****************************************************************************/
+int RenderWait(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize,
+               PULONG pulPos)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+    int written;
+
+    if (ra->pb)
+        DosRequestMutexSem(ra->hmtxDecode, SEM_INDEFINITE_WAIT);
+
+    /* the block being rendered may be done now */
+    written = RenderRead(pInstance, pBuffer, ulSize, pulPos);
+
+    if (written < 0)
+    {
+        ULONG ulStart = QueryTimerMs();
+        ULONG ulLen = RenderSize(pInstance, ulSize,
+                                 kmdecGetPosition(pInstance->dec));
+
+        written = ulLen ? RenderDecode(pInstance, pBuffer, ulLen) : 0;
+        *pulPos = kmdecGetPosition(pInstance->dec);
+
+        RenderAdapt(pInstance, QueryTimerMs() - ulStart, TRUE);
+    }
+
+    if (ra->pb)
+        DosReleaseMutexSem(ra->hmtxDecode);
+
+    return written;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderAdapt                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Adapt blocks to render ahead                          */
+/*                                                                          */
+/* FUNCTION:  Render one more block ahead if decoding a buffer took more    */
+/*            than a half of its playing time, or the callback found no     */
+/*            block rendered ahead.  Render one less block ahead if         */
+/*            decoding has taken less than a quarter for a while.           */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      ULONG      ulTime      -- Time to decode a buffer in ms.            */
+/*      BOOL       fUnderrun   -- TRUE if the callback had to decode.       */
+/*                                                                          */
+/****************************************************************************/
+VOID RenderAdapt(PINSTANCE pInstance, ULONG ulTime, BOOL fUnderrun)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+    ULONG ulPeriod = pInstance->ulBufferTime;
+
+    if (!ra->pb)
+        return;
+
+    DosRequestMutexSem(ra->hmtx, SEM_INDEFINITE_WAIT);
+
+    if (ulTime * 2 > ulPeriod || (fUnderrun && ra->ulAhead))
+    {
+        if (ra->ulAhead < ra->ulMaxBlocks)
+        {
+            ra->ulAhead++;
+
+            LOG_MSG(2, "render %ld blocks ahead, %ld ms for %ld ms",
+                    ra->ulAhead, ulTime, ulPeriod);
+        }
+
+        ra->ulStable = 0;
+    }
+    else if (ulTime * 4 < ulPeriod && ra->ulAhead)
+    {
+        ra->ulStable += ulPeriod;
+        if (ra->ulStable >= RENDER_STABLE_TIME)
+        {
+            ra->ulAhead--;
+            ra->ulStable = 0;
+
+            LOG_MSG(2, "render %ld blocks ahead", ra->ulAhead);
+        }
+    }
+
+    if (ra->ulCount < ra->ulAhead && !ra->End)
+        DosPostEventSem(ra->hev);
+
+    DosReleaseMutexSem(ra->hmtx);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderSize                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Limit the size to decode to the end position          */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      ULONG      ulSize      -- Size to decode.                           */
+/*      int        pos         -- Decoder position.                         */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      Size up to the sample at the end position.                          */
+/*                                                                          */
+/****************************************************************************/
+ULONG RenderSize(PINSTANCE pInstance, ULONG ulSize, int pos)
+{
+    if (pInstance->ulEndPosition)
+    {
+        ULONG ulFrameSize = pInstance->ai.channels * 2;     /* 16 bits */
+        ULONG ulFrames = pos < pInstance->ulEndPosition ?
+                         (unsigned long long)(pInstance->ulEndPosition - pos) *
+                         pInstance->ai.sampleRate / 1000 : 0;
+
+        if (ulFrames < ulSize / ulFrameSize)
+            ulSize = ulFrames * ulFrameSize;
+    }
+
+    return ulSize;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  RenderDecode                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Decode or fill silence                                */
+/*                                                                          */
+/* FUNCTION:  Decode samples to the buffer.  If no note sounds at the       */
+/*            decoder position, fill silence up to the next note instead,   */
+/*            and move the decoder there without synthesizing.  What still  */
+/*            sounds is faded out over RENDER_FADE_FRAMES first.  Silence   */
+/*            is filled in whole ms, and the part of a frame left is        */
+/*            carried to the next call, so that the samples and the         */
+/*            decoder position stay in step.                                */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE  pInstance   -- Pointer to instance.                      */
+/*      PVOID      pBuffer     -- Buffer to fill.                           */
+/*      ULONG      ulSize      -- Size of pBuffer.                          */
+/*                                                                          */
+/* EXIT CODES:                                                              */
+/*      Bytes filled, or -1 on error.                                       */
+/*                                                                          */
+/****************************************************************************/
+int RenderDecode(PINSTANCE pInstance, PVOID pBuffer, ULONG ulSize)
+{
+    RENDERAHEAD *ra = &pInstance->render;
+    ULONG ulTail = ra->ulSilenceTail;
+    int written = 0;
+
+    if (ulTail && pInstance->smf.ulSilences)
+    {
+        int pos = kmdecGetPosition(pInstance->dec);
+        ULONG ulEnd = MidiSilenceEnd(&pInstance->smf, pos, ulTail);
+        ULONG ulFrameSize = pInstance->ai.channels * 2;     /* 16 bits */
+
+        if (!ulEnd)
+            ra->Silent = FALSE;
+        /* fade out what still sounds, seeking stops it at once */
+        else if (!ra->Silent)
+        {
+            ULONG ulFrames = ulSize / ulFrameSize;
+
+            if (ulFrames > RENDER_FADE_FRAMES)
+                ulFrames = RENDER_FADE_FRAMES;
+
+            written = kmdecDecode(pInstance->dec, pBuffer,
+                                  ulFrames * ulFrameSize);
+            if (written < 0)
+                return written;
+
+            fadeOut(pBuffer, written / ulFrameSize, pInstance->ai.channels);
+
+            ra->Silent = TRUE;
+            ra->ulSilenceRem = 0;
+
+            pos = kmdecGetPosition(pInstance->dec);
+            if (pos >= ulEnd)
+                ulEnd = 0;
+        }
+
+        if (ulEnd)
+        {
+            ULONG ulRate = pInstance->ai.sampleRate;
+            unsigned long long ullRoom = (unsigned long long)
+                                         ((ulSize - written) / ulFrameSize) *
+                                         1000;
+            ULONG ulMs = ulEnd - pos;
+            unsigned long long ullFrames;
+
+            /* whole ms whose frames fit in the buffer */
+            if (ullRoom <= ra->ulSilenceRem)
+                ulMs = 0;
+            else if (ulMs > (ullRoom - ra->ulSilenceRem) / ulRate)
+                ulMs = (ullRoom - ra->ulSilenceRem) / ulRate;
+
+            ullFrames = (unsigned long long)ulMs * ulRate + ra->ulSilenceRem;
+
+            if (ulMs &&
+                kmdecSeek(pInstance->dec, pos + ulMs, KMDEC_SEEK_SET) != -1)
+            {
+                ULONG ulLen = ullFrames / 1000 * ulFrameSize;
+
+                memset((PBYTE)pBuffer + written, 0, ulLen);
+                written += ulLen;
+
+                ra->ulSilenceRem = ullFrames % 1000;
+            }
+        }
+    }
+
+    if (written < ulSize)
+    {
+        int n = kmdecDecode(pInstance->dec, (PBYTE)pBuffer + written,
+                            ulSize - written);
+
+        if (n < 0)
+            return written ? written : n;
+
+        written += n;
+    }
+
+    return written;
+}
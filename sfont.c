@@ -0,0 +1,358 @@
+/****************************************************************************
+**
+** sfont.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/****************************************************************************/
+/*                                                                          */
+/* SOURCE FILE NAME:  SFONT.C                                               */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  SOUNDFONT LOOKUP                                      */
+/*                                                                          */
+/* FUNCTION:  This file contains routines to find a SoundFont to load.      */
+/*            SF3 whose samples are compressed with Ogg Vorbis is passed to */
+/*            the decoder as is.  Only fluidsynth 2.x built with libsndfile */
+/*            can load it, decoding its samples in memory.  fluidsynth      */
+/*            1.0.9 cannot, and fails to open it.                           */
+/*                                                                          */
+/* ENTRY POINTS:                                                            */
+/*       GetSoundFont() - Get a path of SoundFont to load                   */
+/*       QuerySampleChunk() - Query the location of sample data             */
+/*       PruneCache() - Prune the cache directory                           */
+/****************************************************************************/
+#define INCL_BASE                    // Base OS2 functions
+#define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
+
+#include <os2.h>                     // OS2 defines.
+#include <string.h>                  // C string functions
+#include <os2me.h>                   // MME includes files.
+#include <stdlib.h>                  // Math functions
+#include "mcdtemp.h"                 // Function Prototypes.
+
+#include <stdio.h>                   // FILE
+#include <dirent.h>                  // opendir()
+#include <sys/stat.h>                // stat()
+#include <sys/fmutex.h>              // _fmutex
+
+#define SF_CACHE_SIZE_DEFAULT   1024    /* in MiB */
+
+static _fmutex cacheLock = _FMUTEX_INITIALIZER;
+
+/* size of the cache directory, -1 if not scanned yet */
+static long long llCacheSize = -1;
+
+#define RIFF_ID(a, b, c, d) ((ULONG)(a) | ((ULONG)(b) << 8) | \
+                             ((ULONG)(c) << 16) | ((ULONG)(d) << 24))
+
+typedef struct {
+    int     major;              /* major version from ifil */
+    long    infoPos;            /* offset of INFO list data */
+    ULONG   infoSize;
+    long    smplPos;            /* offset of smpl chunk data */
+    ULONG   smplSize;
+    long    pdtaPos;            /* offset of pdta list data */
+    ULONG   pdtaSize;
+} SFINFO;
+
+static ULONG getLE32(const BYTE *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+/* find a sub-chunk in a list, and return the size of its data */
+static BOOL findChunk(FILE *fp, long pos, ULONG size, ULONG id,
+                      long *chunkPos, ULONG *chunkSize)
+{
+    BYTE hdr[8];
+    long end = pos + size;
+
+    while (pos + 8 <= end)
+    {
+        if (fseek(fp, pos, SEEK_SET) == -1 || fread(hdr, 1, 8, fp) != 8)
+            return FALSE;
+
+        if (getLE32(hdr) == id)
+        {
+            *chunkPos = pos + 8;
+            *chunkSize = getLE32(hdr + 4);
+
+            return TRUE;
+        }
+
+        pos += 8 + ((getLE32(hdr + 4) + 1) & ~1);
+    }
+
+    return FALSE;
+}
+
+static BOOL parseSoundFont(FILE *fp, SFINFO *sfi)
+{
+    BYTE hdr[12];
+    long pos, end;
+
+    memset(sfi, 0, sizeof(*sfi));
+
+    if (fread(hdr, 1, 12, fp) != 12 ||
+        getLE32(hdr) != RIFF_ID('R', 'I', 'F', 'F') ||
+        getLE32(hdr + 8) != RIFF_ID('s', 'f', 'b', 'k'))
+        return FALSE;
+
+    end = 8 + getLE32(hdr + 4);
+
+    for (pos = 12; pos + 12 <= end; pos += 8 + ((getLE32(hdr + 4) + 1) & ~1))
+    {
+        if (fseek(fp, pos, SEEK_SET) == -1 || fread(hdr, 1, 12, fp) != 12)
+            return FALSE;
+
+        if (getLE32(hdr) != RIFF_ID('L', 'I', 'S', 'T'))
+            continue;
+
+        long  listPos = pos + 12;
+        ULONG listSize = getLE32(hdr + 4) - 4;
+
+        switch (getLE32(hdr + 8))
+        {
+            case RIFF_ID('I', 'N', 'F', 'O'):
+            {
+                long  ifilPos;
+                ULONG ifilSize;
+                BYTE  ver[2];
+
+                sfi->infoPos = listPos;
+                sfi->infoSize = listSize;
+
+                if (findChunk(fp, listPos, listSize,
+                              RIFF_ID('i', 'f', 'i', 'l'),
+                              &ifilPos, &ifilSize) && ifilSize >= 4 &&
+                    fseek(fp, ifilPos, SEEK_SET) != -1 &&
+                    fread(ver, 1, 2, fp) == 2)
+                    sfi->major = ver[0] | (ver[1] << 8);
+                break;
+            }
+
+            case RIFF_ID('s', 'd', 't', 'a'):
+                findChunk(fp, listPos, listSize, RIFF_ID('s', 'm', 'p', 'l'),
+                          &sfi->smplPos, &sfi->smplSize);
+                break;
+
+            case RIFF_ID('p', 'd', 't', 'a'):
+                sfi->pdtaPos = listPos;
+                sfi->pdtaSize = listSize;
+                break;
+        }
+    }
+
+    return sfi->infoPos && sfi->smplPos && sfi->pdtaPos;
+}
+
+typedef struct {
+    CHAR    szName[CCHMAXPATH];
+    time_t  mtime;
+    off_t   size;
+} CACHEENTRY;
+
+static int cmpCacheEntry(const void *p1, const void *p2)
+{
+    const CACHEENTRY *e1 = p1;
+    const CACHEENTRY *e2 = p2;
+
+    return e1->mtime < e2->mtime ? -1 : e1->mtime > e2->mtime;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  PruneCache                                             */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Prune the cache directory                             */
+/*                                                                          */
+/* FUNCTION:  Remove the least recently used MIDI indexes while the cache   */
+/*            directory is over the size given by SFCACHE.  The directory   */
+/*            is scanned only for the first call, and when the running      */
+/*            total of the added files passes the limit.                    */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance, or NULL.                */
+/*      PCSZ      pszKeep   -- file added, not to remove.                   */
+/*      ULONG     ulAdded   -- size of pszKeep in bytes.                    */
+/*                                                                          */
+/****************************************************************************/
+VOID PruneCache(PINSTANCE pInstance, PCSZ pszKeep, ULONG ulAdded)
+{
+    ULONG ulMaxSize = GetDevParamULong(pInstance, "SFCACHE",
+                                       SF_CACHE_SIZE_DEFAULT);
+    DIR *dir;
+    struct dirent *de;
+    CACHEENTRY *entries = NULL;
+    int count = 0;
+    long long total = 0;
+    long long keep = 0;
+    BOOL fScan;
+
+    _fmutex_request(&cacheLock, 0);
+
+    if (llCacheSize >= 0)
+        llCacheSize += ulAdded;
+
+    fScan = llCacheSize < 0 || llCacheSize > (long long)ulMaxSize << 20;
+
+    _fmutex_release(&cacheLock);
+
+    if (!fScan || !(dir = opendir(szSfCacheDir)))
+        return;
+
+    while ((de = readdir(dir)))
+    {
+        CACHEENTRY *e;
+        struct stat st;
+
+        if (!(e = realloc(entries, (count + 1) * sizeof(*entries))))
+            break;
+
+        entries = e;
+        e += count;
+
+        snprintf(e->szName, sizeof(e->szName), "%s\\%s",
+                 szSfCacheDir, de->d_name);
+
+        if (stat(e->szName, &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (!stricmp(e->szName, pszKeep))
+        {
+            keep = st.st_size;
+            continue;
+        }
+
+        e->mtime = st.st_mtime;
+        e->size = st.st_size;
+
+        total += e->size;
+        count++;
+    }
+
+    closedir(dir);
+
+    qsort(entries, count, sizeof(*entries), cmpCacheEntry);
+
+    for (int i = 0; i < count && total > (long long)ulMaxSize << 20; i++)
+    {
+        if (!remove(entries[i].szName))
+            total -= entries[i].size;
+    }
+
+    free(entries);
+
+    _fmutex_request(&cacheLock, 0);
+
+    llCacheSize = total + keep;
+
+    _fmutex_release(&cacheLock);
+}
+
+/* find a SoundFont to load */
+static const char *findSoundFont(struct stat *st)
+{
+    const char *sf = getenv("KSOFTSEQ_SF2");
+
+    if (!sf || stat(sf, st) == -1)
+    {
+        sf = szDefaultSf2;
+
+        if (stat(sf, st) == -1 && stat(szDefaultSf3, st) != -1)
+            sf = szDefaultSf3;
+    }
+
+    return sf;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  GetSoundFont                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Get a path of SoundFont to load                       */
+/*                                                                          */
+/* FUNCTION:  Find a SoundFont pointed by KSOFTSEQ_SF2, or KSOFTSEQ.SF2 and */
+/*            KSOFTSEQ.SF3 in the MMOS2 directory.                          */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PINSTANCE pInstance -- pointer to instance, or NULL.                */
+/*      PSZ       pszSf     -- buffer receiving a path of SoundFont.        */
+/*      ULONG     ulSize    -- size of pszSf.                               */
+/*                                                                          */
+/****************************************************************************/
+VOID GetSoundFont(PINSTANCE pInstance, PSZ pszSf, ULONG ulSize)
+{
+    ULONG ulDepth = pInstance ? pInstance->ulDepth : 2;
+    struct stat st;
+    const char *sf = findSoundFont(&st);
+
+    LOG_MSG(ulDepth, "sf2 = [%s]", sf);
+
+    snprintf(pszSf, ulSize, "%s", sf);
+
+    FILE *fp = fopen(sf, "rb");
+    SFINFO sfi;
+
+    if (!fp)
+        return;
+
+    if (parseSoundFont(fp, &sfi) && sfi.major >= 3)
+        LOG_MSG(ulDepth, "[%s] is SF3, which needs fluidsynth 2.x", sf);
+
+    fclose(fp);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  QuerySampleChunk                                       */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Query the location of sample data                     */
+/*                                                                          */
+/* FUNCTION:  Query the offset and the size of smpl chunk of SoundFont.     */
+/*            Samples of SF3 are compressed and decoded by the decoder, so  */
+/*            they cannot be shared, and FALSE is returned.                 */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PCSZ   pszSf    -- path of SoundFont.                               */
+/*      PLONG  plPos    -- offset of the sample data.                       */
+/*      PULONG pulSize  -- size of the sample data in bytes.                */
+/*                                                                          */
+/* EXIT CODES:  TRUE on success, FALSE otherwise.                           */
+/*                                                                          */
+/****************************************************************************/
+BOOL QuerySampleChunk(PCSZ pszSf, PLONG plPos, PULONG pulSize)
+{
+    FILE *fp = fopen(pszSf, "rb");
+    SFINFO sfi;
+    BOOL rc;
+
+    if (!fp)
+        return FALSE;
+
+    rc = parseSoundFont(fp, &sfi) && sfi.major < 3;
+
+    fclose(fp);
+
+    *plPos = sfi.smplPos;
+    *pulSize = sfi.smplSize;
+
+    return rc;
+}
@@ -0,0 +1,1305 @@
+/****************************************************************************
+**
+** smf.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/****************************************************************************/
+/*                                                                          */
+/* SOURCE FILE NAME:  SMF.C                                                 */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  STANDARD MIDI FILE PARSER                             */
+/*                                                                          */
+/* FUNCTION:  This file contains routines to parse a Standard MIDI File     */
+/*            without the decoder, so that its length, tracks and tempo     */
+/*            can be known without loading SoundFont.  Spans without notes  */
+/*            are also found, so that they need not be synthesized.  The    */
+/*            information is kept in the index in the cache directory, and  */
+/*            used while the file is not changed.                           */
+/*                                                                          */
+/* ENTRY POINTS:                                                            */
+/*       QueryMidiInfo() - Query the information of a MIDI file             */
+/*       FreeMidiInfo() - Free the information of a MIDI file               */
+/*       FlattenMidi() - Flatten and thin a MIDI file                       */
+/*       MidiTicksToMs() - Convert ticks to ms with a tempo map             */
+/*       MidiMsToTicks() - Convert ms to ticks with a tempo map             */
+/*       MidiSilenceEnd() - Query the end of a silence                      */
+/****************************************************************************/
+#define INCL_BASE                    // Base OS2 functions
+#define INCL_MCIOS2                  // use the OS/2 like MMPM/2 headers
+
+#include <os2.h>                     // OS2 defines.
+#include <string.h>                  // C string functions
+#include <os2me.h>                   // MME includes files.
+#include <stdlib.h>                  // Math functions
+#include "mcdtemp.h"                 // Function Prototypes.
+
+#include <stdio.h>                   // FILE
+#include <unistd.h>                  // getpid()
+#include <utime.h>                   // utime()
+#include <sys/stat.h>                // stat()
+
+#define SMF_MAX_FILE_SIZE   ( 16 * 1024 * 1024 )
+
+#define SMF_INDEX_MAGIC     0x494D534BUL    /* "KSMI" */
+#define SMF_INDEX_VERSION   3
+
+#define BE16(p) (((p)[0] << 8) | (p)[1])
+#define BE32(p) (((ULONG)(p)[0] << 24) | ((ULONG)(p)[1] << 16) | \
+                 ((ULONG)(p)[2] << 8) | (p)[3])
+#define LE32(p) (((ULONG)(p)[3] << 24) | ((ULONG)(p)[2] << 16) | \
+                 ((ULONG)(p)[1] << 8) | (p)[0])
+
+typedef struct {
+    ULONG   ulTick;
+    ULONG   ulTempo;            /* microseconds per quarter note */
+    ULONG   ulOrder;            /* to keep the order of the same ticks */
+} TEMPO;
+
+typedef struct {
+    TEMPO  *tempos;
+    ULONG   ulTempos;
+    ULONG   ulMax;
+} TEMPOLIST;
+
+/* change of notes sounding, including sustained ones */
+typedef struct {
+    ULONG   ulTick;
+    LONG    lDelta;
+} ACTIVITY;
+
+typedef struct {
+    ACTIVITY *acts;
+    ULONG   ulActs;
+    ULONG   ulMax;
+} ACTLIST;
+
+/* header of an index file followed by a tempo map and silences */
+typedef struct {
+    ULONG   ulMagic;
+    ULONG   ulVersion;
+    CHAR    szFile[CCHMAXPATH];         /* full path in upper case */
+    ULONG   ulSize;                     /* of MIDI file */
+    ULONG   ulMtime;
+    SMFINFO info;                       /* pTempos is not valid */
+} SMFINDEX;
+
+/* read a file into memory */
+static PBYTE readFile(PCSZ pszFile, PULONG pulSize)
+{
+    FILE *fp = fopen(pszFile, "rb");
+    PBYTE buf = NULL;
+    long size;
+
+    if (!fp)
+        return NULL;
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 &&
+        size <= SMF_MAX_FILE_SIZE && (buf = malloc(size)))
+    {
+        rewind(fp);
+
+        if (fread(buf, 1, size, fp) != size)
+        {
+            free(buf);
+            buf = NULL;
+        }
+        else
+            *pulSize = size;
+    }
+
+    fclose(fp);
+
+    return buf;
+}
+
+/* find SMF in a RIFF MIDI file */
+static PBYTE findSmf(PBYTE buf, PULONG pulSize)
+{
+    PBYTE end = buf + *pulSize;
+    PBYTE p;
+
+    if (*pulSize < 12 || memcmp(buf, "RIFF", 4) || memcmp(buf + 8, "RMID", 4))
+        return buf;
+
+    for (p = buf + 12; p + 8 <= end; p += 8 + ((LE32(p + 4) + 1) & ~1))
+    {
+        if (!memcmp(p, "data", 4))
+        {
+            ULONG ulSize = LE32(p + 4);
+
+            if (ulSize > end - p - 8)
+                ulSize = end - p - 8;
+
+            *pulSize = ulSize;
+
+            return p + 8;
+        }
+    }
+
+    return NULL;
+}
+
+static ULONG readVarLen(PBYTE *pp, PBYTE end)
+{
+    ULONG value = 0;
+    PBYTE p = *pp;
+
+    while (p < end)
+    {
+        BYTE b = *p++;
+
+        value = (value << 7) | (b & 0x7F);
+
+        if (!(b & 0x80))
+            break;
+    }
+
+    *pp = p;
+
+    return value;
+}
+
+static BOOL addTempo(TEMPOLIST *list, ULONG ulTick, ULONG ulTempo)
+{
+    if (list->ulTempos == list->ulMax)
+    {
+        ULONG ulMax = list->ulMax ? list->ulMax * 2 : 16;
+        TEMPO *tempos = realloc(list->tempos, ulMax * sizeof(*tempos));
+
+        if (!tempos)
+            return FALSE;
+
+        list->tempos = tempos;
+        list->ulMax = ulMax;
+    }
+
+    list->tempos[list->ulTempos].ulTick = ulTick;
+    list->tempos[list->ulTempos].ulTempo = ulTempo;
+    list->tempos[list->ulTempos].ulOrder = list->ulTempos;
+    list->ulTempos++;
+
+    return TRUE;
+}
+
+static int cmpTempo(const void *a, const void *b)
+{
+    const TEMPO *t1 = a;
+    const TEMPO *t2 = b;
+
+    if (t1->ulTick != t2->ulTick)
+        return t1->ulTick < t2->ulTick ? -1 : 1;
+
+    return t1->ulOrder < t2->ulOrder ? -1 : t1->ulOrder > t2->ulOrder;
+}
+
+static BOOL addActivity(ACTLIST *list, ULONG ulTick, LONG lDelta)
+{
+    /* merge changes at the same tick */
+    if (list->ulActs && list->acts[list->ulActs - 1].ulTick == ulTick)
+    {
+        list->acts[list->ulActs - 1].lDelta += lDelta;
+
+        return TRUE;
+    }
+
+    if (list->ulActs == list->ulMax)
+    {
+        ULONG ulMax = list->ulMax ? list->ulMax * 2 : 256;
+        ACTIVITY *acts = realloc(list->acts, ulMax * sizeof(*acts));
+
+        if (!acts)
+            return FALSE;
+
+        list->acts = acts;
+        list->ulMax = ulMax;
+    }
+
+    list->acts[list->ulActs].ulTick = ulTick;
+    list->acts[list->ulActs].lDelta = lDelta;
+    list->ulActs++;
+
+    return TRUE;
+}
+
+static int cmpActivity(const void *a, const void *b)
+{
+    const ACTIVITY *a1 = a;
+    const ACTIVITY *a2 = b;
+
+    return a1->ulTick < a2->ulTick ? -1 : a1->ulTick > a2->ulTick;
+}
+
+/* count a note of a key started or stopped */
+static BOOL noteActivity(ACTLIST *acts, ULONG ulTick, PBYTE pbCount, BOOL fOn)
+{
+    if (fOn)
+    {
+        if (*pbCount == 255)
+            return TRUE;
+
+        (*pbCount)++;
+
+        return addActivity(acts, ulTick, 1);
+    }
+
+    if (!*pbCount)
+        return TRUE;
+
+    (*pbCount)--;
+
+    return addActivity(acts, ulTick, -1);
+}
+
+/* count the sustain pedal, and stop notes on all notes off */
+static BOOL controlActivity(ACTLIST *acts, ULONG ulTick, PBYTE abCount,
+                            PBOOL pfPedal, BYTE bController, BYTE bValue)
+{
+    LONG lDelta = 0;
+
+    switch (bController)
+    {
+        case 64:    /* sustain */
+            if (*pfPedal == (bValue >= 64))
+                return TRUE;
+
+            *pfPedal = bValue >= 64;
+
+            return addActivity(acts, ulTick, *pfPedal ? 1 : -1);
+
+        case 120:   /* all sound off */
+        case 123:   /* all notes off */
+            for (int i = 0; i < 128; i++)
+            {
+                lDelta -= abCount[i];
+                abCount[i] = 0;
+            }
+
+            return !lDelta || addActivity(acts, ulTick, lDelta);
+    }
+
+    return TRUE;
+}
+
+/* scan a track for the tempo changes, the notes and the last tick */
+static BOOL scanTrack(PBYTE p, PBYTE end, TEMPOLIST *list, ACTLIST *acts,
+                      PULONG pulEndTick)
+{
+    ULONG tick = 0;
+    BYTE status = 0;
+    BYTE abNotes[16][128];
+    BOOL afPedal[16];
+
+    memset(abNotes, 0, sizeof(abNotes));
+    memset(afPedal, 0, sizeof(afPedal));
+
+    while (p < end)
+    {
+        tick += readVarLen(&p, end);
+
+        if (p >= end)
+            break;
+
+        if (*p == 0xFF)
+        {
+            /* meta event */
+            BYTE type;
+            ULONG len;
+
+            if (p + 2 > end)
+                return FALSE;
+
+            type = p[1];
+            p += 2;
+            len = readVarLen(&p, end);
+
+            if (len > end - p)
+                return FALSE;
+
+            /* ignore a zero tempo, which would stop the time */
+            if (type == 0x51 && len == 3 && (p[0] | p[1] | p[2]) &&
+                !addTempo(list, tick, (p[0] << 16) | (p[1] << 8) | p[2]))
+                return FALSE;
+
+            p += len;
+
+            if (type == 0x2F)   /* end of track */
+                break;
+
+            continue;
+        }
+
+        if (*p == 0xF0 || *p == 0xF7)
+        {
+            /* system exclusive */
+            ULONG len;
+
+            p++;
+            len = readVarLen(&p, end);
+
+            if (len > end - p)
+                return FALSE;
+
+            p += len;
+            status = 0;
+
+            continue;
+        }
+
+        if (*p & 0x80)
+            status = *p++;
+        else if (!status)
+            return FALSE;
+
+        BYTE ch = status & 0x0F;
+
+        switch (status & 0xF0)
+        {
+            case 0x80:  /* note off */
+            case 0x90:  /* note on */
+                if (p + 2 <= end &&
+                    !noteActivity(acts, tick, &abNotes[ch][p[0] & 0x7F],
+                                  (status & 0xF0) == 0x90 && p[1]))
+                    return FALSE;
+                p += 2;
+                break;
+
+            case 0xB0:  /* control change */
+                if (p + 2 <= end &&
+                    !controlActivity(acts, tick, abNotes[ch], &afPedal[ch],
+                                     p[0], p[1]))
+                    return FALSE;
+                p += 2;
+                break;
+
+            case 0xC0:  /* program change */
+            case 0xD0:  /* channel pressure */
+                p += 1;
+                break;
+
+            default:
+                p += 2;
+                break;
+        }
+    }
+
+    *pulEndTick = tick;
+
+    return TRUE;
+}
+
+/* build a tempo map with the time of each tempo change */
+static BOOL buildTempoMap(SMFINFO *pInfo, TEMPOLIST *list)
+{
+    unsigned long long us = 0;
+    ULONG ulLastTick = 0;
+    ULONG ulTempo = SMF_TEMPO_DEFAULT;
+
+    qsort(list->tempos, list->ulTempos, sizeof(*list->tempos), cmpTempo);
+
+    if (list->ulTempos &&
+        !(pInfo->pTempos = malloc(list->ulTempos * sizeof(SMFTEMPO))))
+        return FALSE;
+
+    for (ULONG i = 0; i < list->ulTempos; i++)
+    {
+        SMFTEMPO *t = &pInfo->pTempos[i];
+
+        us += (unsigned long long)(list->tempos[i].ulTick - ulLastTick) *
+              ulTempo;
+
+        ulLastTick = list->tempos[i].ulTick;
+        ulTempo = list->tempos[i].ulTempo;
+
+        t->ulTick = ulLastTick;
+        t->ulTempo = ulTempo;
+        t->ulMs = pInfo->usDivision ? us / pInfo->usDivision / 1000 : 0;
+    }
+
+    pInfo->ulTempos = list->ulTempos;
+    pInfo->ulTempo = list->ulTempos && list->tempos[0].ulTick == 0 ?
+                     list->tempos[0].ulTempo : SMF_TEMPO_DEFAULT;
+
+    return TRUE;
+}
+
+/* find the last tempo change at or before ulTick or ulMs by binary search */
+static SMFTEMPO *findTempo(SMFINFO *pInfo, ULONG ulTick, ULONG ulMs)
+{
+    LONG lo = 0;
+    LONG hi = (LONG)pInfo->ulTempos - 1;
+    SMFTEMPO *found = NULL;
+
+    while (lo <= hi)
+    {
+        LONG mid = (lo + hi) / 2;
+        SMFTEMPO *t = &pInfo->pTempos[mid];
+
+        if (t->ulTick <= ulTick && t->ulMs <= ulMs)
+        {
+            found = t;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    return found;
+}
+
+/* frames per second and ticks per frame of SMPTE division */
+static BOOL smpteDivision(SMFINFO *pInfo, PULONG pulFps, PULONG pulTpf)
+{
+    if (!(pInfo->usDivision & 0x8000))
+        return FALSE;
+
+    *pulFps = -(signed char)(pInfo->usDivision >> 8);
+    *pulTpf = pInfo->usDivision & 0xFF;
+
+    return TRUE;
+}
+
+/* find the spans without notes */
+static BOOL buildSilences(SMFINFO *pInfo, ACTLIST *list, ULONG ulEndTick)
+{
+    SMFSILENCE *silences;
+    ULONG ulSilences = 0;
+    ULONG ulFrom = 0;                   /* tick when the silence started */
+    BOOL fSilent = TRUE;
+    LONG lLevel = 0;
+
+    qsort(list->acts, list->ulActs, sizeof(*list->acts), cmpActivity);
+
+    /* a silence before each note-on after silence, and one at the end */
+    if (!(silences = malloc((list->ulActs + 1) * sizeof(*silences))))
+        return FALSE;
+
+    for (ULONG i = 0; i <= list->ulActs; i++)
+    {
+        ULONG ulTick = i < list->ulActs ? list->acts[i].ulTick : ulEndTick;
+
+        if (i < list->ulActs)
+        {
+            lLevel += list->acts[i].lDelta;
+
+            /* the next change at the same tick from other tracks */
+            if (i + 1 < list->ulActs && list->acts[i + 1].ulTick == ulTick)
+                continue;
+        }
+
+        if (fSilent && (lLevel > 0 || i == list->ulActs))
+        {
+            SMFSILENCE *s = &silences[ulSilences];
+
+            s->ulStart = ulFrom ? MidiTicksToMs(pInfo, ulFrom) : 0;
+            s->ulEnd = MidiTicksToMs(pInfo, ulTick);
+
+            if (s->ulEnd > s->ulStart)
+                ulSilences++;
+
+            fSilent = FALSE;
+        }
+        else if (!fSilent && lLevel <= 0)
+        {
+            ulFrom = ulTick;
+            fSilent = TRUE;
+        }
+    }
+
+    if (!ulSilences)
+    {
+        free(silences);
+        silences = NULL;
+    }
+
+    pInfo->ulSilences = ulSilences;
+    pInfo->pSilences = silences;
+
+    return TRUE;
+}
+
+/* parse a MIDI file */
+static BOOL parseMidi(PCSZ pszFile, SMFINFO *pInfo)
+{
+    TEMPOLIST list = { NULL, 0, 0 };
+    ACTLIST acts = { NULL, 0, 0 };
+    ULONG ulSize;
+    ULONG ulEndTick = 0;
+    PBYTE buf, smf, p, end;
+    BOOL rc = FALSE;
+
+    if (!(buf = readFile(pszFile, &ulSize)))
+        return FALSE;
+
+    if (!(smf = findSmf(buf, &ulSize)) || ulSize < 14 ||
+        memcmp(smf, "MThd", 4) || BE32(smf + 4) < 6)
+        goto exit_free;
+
+    end = smf + ulSize;
+
+    pInfo->ulFormat = BE16(smf + 8);
+    pInfo->usDivision = BE16(smf + 12);
+
+    ULONG ulTracks = BE16(smf + 10);
+
+    for (p = smf + 8 + BE32(smf + 4);
+         p + 8 <= end && pInfo->ulTracks < ulTracks;
+         p += 8 + BE32(p + 4))
+    {
+        ULONG ulLen = BE32(p + 4);
+        ULONG ulTick;
+
+        if (ulLen > end - p - 8)
+            ulLen = end - p - 8;
+
+        if (memcmp(p, "MTrk", 4))
+            continue;
+
+        if (!scanTrack(p + 8, p + 8 + ulLen, &list, &acts, &ulTick))
+            goto exit_free;
+
+        if (ulEndTick < ulTick)
+            ulEndTick = ulTick;
+
+        pInfo->ulTracks++;
+
+        if (ulLen != BE32(p + 4))
+            break;
+    }
+
+    if (!pInfo->ulTracks || !buildTempoMap(pInfo, &list))
+        goto exit_free;
+
+    pInfo->ulDuration = MidiTicksToMs(pInfo, ulEndTick);
+
+    if (!buildSilences(pInfo, &acts, ulEndTick))
+        goto exit_free;
+
+    rc = TRUE;
+
+exit_free:
+    free(acts.acts);
+    free(list.tempos);
+    free(buf);
+
+    return rc;
+}
+
+/* read the information from an index */
+static BOOL readIndex(PCSZ pszIndex, SMFINDEX *idx, SMFINFO *pInfo)
+{
+    FILE *fp = fopen(pszIndex, "rb");
+    SMFINDEX saved;
+    BOOL rc = FALSE;
+
+    if (!fp)
+        return FALSE;
+
+    if (fread(&saved, sizeof(saved), 1, fp) == 1 &&
+        saved.ulMagic == idx->ulMagic && saved.ulVersion == idx->ulVersion &&
+        !strcmp(saved.szFile, idx->szFile) &&
+        saved.ulSize == idx->ulSize && saved.ulMtime == idx->ulMtime)
+    {
+        *pInfo = saved.info;
+        pInfo->pTempos = NULL;
+        pInfo->pSilences = NULL;
+
+        if ((!pInfo->ulTempos ||
+             ((pInfo->pTempos = malloc(pInfo->ulTempos * sizeof(SMFTEMPO))) &&
+              fread(pInfo->pTempos, sizeof(SMFTEMPO), pInfo->ulTempos, fp) ==
+                pInfo->ulTempos)) &&
+            (!pInfo->ulSilences ||
+             ((pInfo->pSilences =
+                malloc(pInfo->ulSilences * sizeof(SMFSILENCE))) &&
+              fread(pInfo->pSilences, sizeof(SMFSILENCE), pInfo->ulSilences,
+                    fp) == pInfo->ulSilences)))
+            rc = TRUE;
+
+        /* an index made before zero tempos were ignored may have them */
+        for (ULONG i = 0; rc && i < pInfo->ulTempos; i++)
+            rc = pInfo->pTempos[i].ulTempo != 0;
+
+        if (!rc)
+            FreeMidiInfo(pInfo);
+    }
+
+    fclose(fp);
+
+    return rc;
+}
+
+/* write the information to an index */
+static VOID writeIndex(PCSZ pszIndex, SMFINDEX *idx, SMFINFO *pInfo,
+                       ULONG ulHash)
+{
+    CHAR szTemp[CCHMAXPATH];
+    FILE *fp;
+    BOOL rc;
+
+    snprintf(szTemp, sizeof(szTemp), "%s\\%08lX.%03X",
+             szSfCacheDir, ulHash, getpid() & 0xFFF);
+
+    mkdir(szSfCacheDir, 0777);
+
+    if (!(fp = fopen(szTemp, "wb")))
+        return;
+
+    idx->info = *pInfo;
+    idx->info.pTempos = NULL;
+    idx->info.pSilences = NULL;
+
+    rc = fwrite(idx, sizeof(*idx), 1, fp) == 1 &&
+         fwrite(pInfo->pTempos, sizeof(SMFTEMPO), pInfo->ulTempos, fp) ==
+            pInfo->ulTempos &&
+         fwrite(pInfo->pSilences, sizeof(SMFSILENCE), pInfo->ulSilences,
+                fp) == pInfo->ulSilences;
+
+    if (fclose(fp) || !rc || rename(szTemp, pszIndex) == -1)
+        remove(szTemp);
+    else
+        PruneCache(NULL, pszIndex,
+                   sizeof(*idx) + pInfo->ulTempos * sizeof(SMFTEMPO) +
+                   pInfo->ulSilences * sizeof(SMFSILENCE));
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  QueryMidiInfo                                          */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Query the information of a MIDI file                  */
+/*                                                                          */
+/* FUNCTION:  Parse a Standard MIDI File or a RIFF MIDI file, and query     */
+/*            its length, the number of tracks, the tempo map and the       */
+/*            silences.  If the index of the file is in the cache           */
+/*            directory, use it instead of parsing.                         */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PCSZ     pszFile -- path of MIDI file.                              */
+/*      SMFINFO *pInfo   -- information of MIDI file.  It should be freed   */
+/*                          with FreeMidiInfo().                            */
+/*                                                                          */
+/* EXIT CODES:  TRUE on success, FALSE otherwise.                           */
+/*                                                                          */
+/****************************************************************************/
+BOOL QueryMidiInfo(PCSZ pszFile, SMFINFO *pInfo)
+{
+    SMFINDEX idx;
+    CHAR  szIndex[CCHMAXPATH];
+    ULONG ulHash = 2166136261UL;        /* FNV-1a of path, size and mtime */
+    struct stat st;
+
+    memset(pInfo, 0, sizeof(*pInfo));
+
+    if (stat(pszFile, &st) == -1)
+        return FALSE;
+
+    memset(&idx, 0, sizeof(idx));
+    idx.ulMagic = SMF_INDEX_MAGIC;
+    idx.ulVersion = SMF_INDEX_VERSION;
+    idx.ulSize = st.st_size;
+    idx.ulMtime = st.st_mtime;
+
+    _fullpath(idx.szFile, pszFile, sizeof(idx.szFile));
+    strupr(idx.szFile);
+
+    for (const char *p = idx.szFile; *p; p++)
+        ulHash = (ulHash ^ (BYTE)*p) * 16777619UL;
+
+    ulHash = (ulHash ^ st.st_size) * 16777619UL;
+    ulHash = (ulHash ^ st.st_mtime) * 16777619UL;
+
+    snprintf(szIndex, sizeof(szIndex), "%s\\%08lX.MIX",
+             szSfCacheDir, ulHash);
+
+    if (readIndex(szIndex, &idx, pInfo))
+    {
+        utime(szIndex, NULL);           /* mark as recently used */
+
+        LOG_MSG(2, "index [%s] used", szIndex);
+    }
+    else if (parseMidi(pszFile, pInfo))
+        writeIndex(szIndex, &idx, pInfo, ulHash);
+    else
+    {
+        FreeMidiInfo(pInfo);
+
+        return FALSE;
+    }
+
+    LOG_MSG(2, "format %ld, %ld tracks, division 0x%x, tempo %ld, "
+               "%ld tempo changes, %ld silences, %ld ms",
+            pInfo->ulFormat, pInfo->ulTracks, pInfo->usDivision,
+            pInfo->ulTempo, pInfo->ulTempos, pInfo->ulSilences,
+            pInfo->ulDuration);
+
+    return TRUE;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  FreeMidiInfo                                           */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Free the information of a MIDI file                   */
+/*                                                                          */
+/* FUNCTION:  Free the information queried by QueryMidiInfo().              */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      SMFINFO *pInfo   -- information of MIDI file.                       */
+/*                                                                          */
+/****************************************************************************/
+VOID FreeMidiInfo(SMFINFO *pInfo)
+{
+    free(pInfo->pTempos);
+    free(pInfo->pSilences);
+
+    memset(pInfo, 0, sizeof(*pInfo));
+}
+
+/* an event of a track to be merged */
+typedef struct {
+    ULONG   ulTick;
+    ULONG   ulIndex;            /* in order of tracks and events */
+    BYTE    bStatus;            /* status, 0xFF for meta, 0 if thinned */
+    BYTE    bType;              /* type of meta event */
+    PBYTE   pbData;
+    ULONG   ulLen;
+} EVENT;
+
+typedef struct {
+    EVENT  *events;
+    ULONG   ulEvents;
+    ULONG   ulMax;
+} EVENTLIST;
+
+static BOOL addEvent(EVENTLIST *list, ULONG ulTick, BYTE bStatus, BYTE bType,
+                     PBYTE pbData, ULONG ulLen)
+{
+    if (list->ulEvents == list->ulMax)
+    {
+        ULONG ulMax = list->ulMax ? list->ulMax * 2 : 1024;
+        EVENT *events = realloc(list->events, ulMax * sizeof(*events));
+
+        if (!events)
+            return FALSE;
+
+        list->events = events;
+        list->ulMax = ulMax;
+    }
+
+    EVENT *e = &list->events[list->ulEvents];
+
+    e->ulTick = ulTick;
+    e->ulIndex = list->ulEvents;
+    e->bStatus = bStatus;
+    e->bType = bType;
+    e->pbData = pbData;
+    e->ulLen = ulLen;
+
+    list->ulEvents++;
+
+    return TRUE;
+}
+
+static int cmpEvent(const void *a, const void *b)
+{
+    const EVENT *e1 = a;
+    const EVENT *e2 = b;
+
+    if (e1->ulTick != e2->ulTick)
+        return e1->ulTick < e2->ulTick ? -1 : 1;
+
+    return e1->ulIndex < e2->ulIndex ? -1 : e1->ulIndex > e2->ulIndex;
+}
+
+/* collect events of a track except end of track */
+static BOOL collectTrack(PBYTE p, PBYTE end, EVENTLIST *list,
+                         PULONG pulEndTick)
+{
+    ULONG tick = 0;
+    BYTE status = 0;
+
+    while (p < end)
+    {
+        tick += readVarLen(&p, end);
+
+        if (p >= end)
+            break;
+
+        if (*p == 0xFF)
+        {
+            /* meta event */
+            BYTE type;
+            ULONG len;
+
+            if (p + 2 > end)
+                return FALSE;
+
+            type = p[1];
+            p += 2;
+            len = readVarLen(&p, end);
+
+            if (len > end - p)
+                return FALSE;
+
+            if (type == 0x2F)   /* end of track */
+                break;
+
+            if (!addEvent(list, tick, 0xFF, type, p, len))
+                return FALSE;
+
+            p += len;
+
+            continue;
+        }
+
+        if (*p == 0xF0 || *p == 0xF7)
+        {
+            /* system exclusive */
+            BYTE type = *p++;
+            ULONG len = readVarLen(&p, end);
+
+            if (len > end - p || !addEvent(list, tick, type, 0, p, len))
+                return FALSE;
+
+            p += len;
+            status = 0;
+
+            continue;
+        }
+
+        if (*p & 0x80)
+            status = *p++;
+        else if (!status)
+            return FALSE;
+
+        ULONG len = (status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0 ? 1 : 2;
+
+        if (len > end - p || !addEvent(list, tick, status, 0, p, len))
+            return FALSE;
+
+        p += len;
+    }
+
+    *pulEndTick = tick;
+
+    return TRUE;
+}
+
+/* state of a controller of a channel while thinning */
+typedef struct {
+    EVENT  *last;               /* last event kept */
+    ULONG   ulAnchorMs;         /* time from which events are coalesced */
+} THINSLOT;
+
+/* controllers, pitch bend, channel pressure and key pressures */
+#define THIN_SLOT_BEND      128
+#define THIN_SLOT_PRESSURE  129
+#define THIN_SLOT_KEY       130
+#define THIN_SLOTS          (THIN_SLOT_KEY + 128)
+
+/* continuous controllers, except ones whose repeated messages are
+   meaningful */
+static BOOL isThinnable(BYTE bController)
+{
+    switch (bController)
+    {
+        case 64: case 65: case 66:      /* sustain, portamento, sostenuto */
+        case 67: case 68: case 69:      /* soft, legato, hold 2 */
+        case 80: case 81: case 82:      /* general purpose buttons */
+        case 83:
+        case 84:                        /* portamento control */
+        case 88:                        /* high resolution velocity prefix */
+            return FALSE;               /* switches, or bound to a note */
+
+        case 0:  case 32:               /* bank select */
+        case 6:  case 38:               /* data entry */
+        case 96: case 97:               /* data increment and decrement */
+        case 98: case 99:               /* NRPN */
+        case 100: case 101:             /* RPN */
+            return FALSE;
+    }
+
+    return bController < 120;          /* not channel mode messages */
+}
+
+/* drop redundant controller messages from the sorted events */
+static ULONG thinEvents(EVENTLIST *list, SMFINFO *pInfo, ULONG ulWindowMs)
+{
+    THINSLOT *slots = calloc(16 * THIN_SLOTS, sizeof(*slots));
+    ULONG ulDropped = 0;
+
+    if (!slots)
+        return 0;
+
+    for (ULONG i = 0; i < list->ulEvents; i++)
+    {
+        EVENT *e = &list->events[i];
+        BYTE bCmd = e->bStatus & 0xF0;
+        THINSLOT *chslots = slots + (e->bStatus & 0x0F) * THIN_SLOTS;
+        THINSLOT *slot;
+        ULONG ulMs;
+
+        if (e->bStatus == 0xF0 || e->bStatus == 0xF7)
+        {
+            /* a reset may change any controller */
+            memset(slots, 0, 16 * THIN_SLOTS * sizeof(*slots));
+            continue;
+        }
+
+        switch (bCmd)
+        {
+            case 0x90:
+                /* a note starts with the current values */
+                for (ULONG j = 0; j < THIN_SLOTS; j++)
+                    chslots[j].ulAnchorMs = -1;
+                continue;
+
+            case 0xA0:
+                slot = &chslots[THIN_SLOT_KEY + (e->pbData[0] & 0x7F)];
+                break;
+
+            case 0xB0:
+                if (e->pbData[0] == 121)    /* reset all controllers */
+                    memset(chslots, 0, THIN_SLOTS * sizeof(*slots));
+
+                if (!isThinnable(e->pbData[0]))
+                    continue;
+
+                slot = &chslots[e->pbData[0]];
+                break;
+
+            case 0xD0:
+                slot = &chslots[THIN_SLOT_PRESSURE];
+                break;
+
+            case 0xE0:
+                slot = &chslots[THIN_SLOT_BEND];
+                break;
+
+            default:
+                continue;
+        }
+
+        if (slot->last &&
+            !memcmp(slot->last->pbData, e->pbData, e->ulLen))
+        {
+            /* the same value again */
+            e->bStatus = 0;
+            ulDropped++;
+
+            continue;
+        }
+
+        ulMs = MidiTicksToMs(pInfo, e->ulTick);
+
+        if (slot->last && slot->ulAnchorMs != (ULONG)-1 &&
+            ulMs - slot->ulAnchorMs < ulWindowMs)
+        {
+            /* only the last value in a window is kept */
+            slot->last->bStatus = 0;
+            ulDropped++;
+        }
+        else
+            slot->ulAnchorMs = ulMs;
+
+        slot->last = e;
+    }
+
+    free(slots);
+
+    return ulDropped;
+}
+
+static PBYTE writeVarLen(PBYTE p, ULONG value)
+{
+    BYTE buf[5];
+    int n = 0;
+
+    do
+    {
+        buf[n++] = value & 0x7F;
+        value >>= 7;
+    } while (value);
+
+    while (n > 1)
+        *p++ = buf[--n] | 0x80;
+
+    *p++ = buf[0];
+
+    return p;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  FlattenMidi                                            */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Flatten and thin a MIDI file                          */
+/*                                                                          */
+/* FUNCTION:  Merge all the tracks of a type-1 MIDI file into one track     */
+/*            sorted by time, and return it as a type-0 SMF in memory.      */
+/*            Events at the same time keep the order of tracks, so the      */
+/*            decoder has only one track to walk while playing.             */
+/*            If ulThinMs is not 0, repeated controller values are dropped  */
+/*            and only the last value of a controller within ulThinMs is    */
+/*            kept until a note starts on the channel.                      */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      PCSZ     pszFile  -- path of MIDI file.                             */
+/*      SMFINFO *pInfo    -- information of MIDI file for the tempo map.    */
+/*      ULONG    ulThinMs -- window to thin controllers in ms.              */
+/*      PULONG   pulSize  -- size of the returned SMF.                      */
+/*                                                                          */
+/* EXIT CODES:  SMF to be freed with free(), or NULL if the file is not a   */
+/*              type-0 or type-1 MIDI file, or on error.                    */
+/*                                                                          */
+/****************************************************************************/
+PBYTE FlattenMidi(PCSZ pszFile, SMFINFO *pInfo, ULONG ulThinMs,
+                  PULONG pulSize)
+{
+    EVENTLIST list = { NULL, 0, 0 };
+    ULONG ulSize;
+    ULONG ulEndTick = 0;
+    ULONG ulTracks = 0;
+    ULONG ulMaxSize = 14 + 8 + 4;       /* MThd, MTrk and end of track */
+    PBYTE buf, smf, p, end;
+    PBYTE flat = NULL;
+
+    if (!(buf = readFile(pszFile, &ulSize)))
+        return NULL;
+
+    if (!(smf = findSmf(buf, &ulSize)) || ulSize < 14 ||
+        memcmp(smf, "MThd", 4) || BE32(smf + 4) < 6 ||
+        BE16(smf + 8) > 1 || BE16(smf + 10) < 1)
+        goto exit_free;
+
+    end = smf + ulSize;
+
+    for (p = smf + 8 + BE32(smf + 4);
+         p + 8 <= end && ulTracks < BE16(smf + 10);
+         p += 8 + BE32(p + 4))
+    {
+        ULONG ulLen = BE32(p + 4);
+        ULONG ulTick;
+
+        if (ulLen > end - p - 8)
+            ulLen = end - p - 8;
+
+        if (memcmp(p, "MTrk", 4))
+            continue;
+
+        if (!collectTrack(p + 8, p + 8 + ulLen, &list, &ulTick))
+            goto exit_free;
+
+        if (ulEndTick < ulTick)
+            ulEndTick = ulTick;
+
+        ulTracks++;
+
+        if (ulLen != BE32(p + 4))
+            break;
+    }
+
+    qsort(list.events, list.ulEvents, sizeof(*list.events), cmpEvent);
+
+    ULONG ulThinned = ulThinMs ? thinEvents(&list, pInfo, ulThinMs) : 0;
+
+    /* delta, status, type, length and data */
+    for (ULONG i = 0; i < list.ulEvents; i++)
+        ulMaxSize += 4 + 1 + 1 + 4 + list.events[i].ulLen;
+
+    if (!(flat = malloc(ulMaxSize)))
+        goto exit_free;
+
+    /* MThd of type 0 with one track */
+    memcpy(flat, "MThd\0\0\0\6\0\0\0\1", 12);
+    memcpy(flat + 12, smf + 12, 2);
+    memcpy(flat + 14, "MTrk", 4);
+
+    ULONG ulTick = 0;
+    BYTE status = 0;
+
+    p = flat + 14 + 8;
+
+    for (ULONG i = 0; i < list.ulEvents; i++)
+    {
+        EVENT *e = &list.events[i];
+
+        if (!e->bStatus)    /* thinned */
+            continue;
+
+        p = writeVarLen(p, e->ulTick - ulTick);
+        ulTick = e->ulTick;
+
+        if (e->bStatus == 0xFF)
+        {
+            *p++ = 0xFF;
+            *p++ = e->bType;
+            p = writeVarLen(p, e->ulLen);
+            status = 0;
+        }
+        else if (e->bStatus == 0xF0 || e->bStatus == 0xF7)
+        {
+            *p++ = e->bStatus;
+            p = writeVarLen(p, e->ulLen);
+            status = 0;
+        }
+        else if (e->bStatus != status)
+            *p++ = status = e->bStatus;     /* running status otherwise */
+
+        memcpy(p, e->pbData, e->ulLen);
+        p += e->ulLen;
+    }
+
+    /* end of track */
+    p = writeVarLen(p, ulEndTick > ulTick ? ulEndTick - ulTick : 0);
+    memcpy(p, "\xFF\x2F\0", 3);
+    p += 3;
+
+    ULONG ulTrackLen = p - (flat + 14 + 8);
+
+    flat[18] = ulTrackLen >> 24;
+    flat[19] = ulTrackLen >> 16;
+    flat[20] = ulTrackLen >> 8;
+    flat[21] = ulTrackLen;
+
+    *pulSize = p - flat;
+
+    LOG_MSG(2, "%ld tracks, %ld events flattened to %ld bytes, %ld thinned",
+            ulTracks, list.ulEvents, *pulSize, ulThinned);
+
+exit_free:
+    free(list.events);
+    free(buf);
+
+    return flat;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  MidiTicksToMs                                          */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Convert ticks to ms with a tempo map                  */
+/*                                                                          */
+/* FUNCTION:  Convert ticks of MIDI file to ms.  The tempo change before    */
+/*            the time is found by binary search on the tempo map.          */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      SMFINFO *pInfo   -- information of MIDI file.                       */
+/*      ULONG    ulTick  -- ticks.                                          */
+/*                                                                          */
+/* EXIT CODES:  ms                                                          */
+/*                                                                          */
+/****************************************************************************/
+ULONG MidiTicksToMs(SMFINFO *pInfo, ULONG ulTick)
+{
+    SMFTEMPO *t;
+    ULONG fps, tpf;
+
+    if (smpteDivision(pInfo, &fps, &tpf))
+        return fps && tpf ? (unsigned long long)ulTick * 1000 / (fps * tpf)
+                          : 0;
+
+    if (!pInfo->usDivision)
+        return 0;
+
+    if (!(t = findTempo(pInfo, ulTick, -1)))
+        return (unsigned long long)ulTick * SMF_TEMPO_DEFAULT /
+               pInfo->usDivision / 1000;
+
+    return t->ulMs + (unsigned long long)(ulTick - t->ulTick) * t->ulTempo /
+                     pInfo->usDivision / 1000;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  MidiMsToTicks                                          */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Convert ms to ticks with a tempo map                  */
+/*                                                                          */
+/* FUNCTION:  Convert ms to ticks of MIDI file.  The tempo change before    */
+/*            the time is found by binary search on the tempo map.          */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      SMFINFO *pInfo   -- information of MIDI file.                       */
+/*      ULONG    ulMs    -- ms.                                             */
+/*                                                                          */
+/* EXIT CODES:  ticks                                                       */
+/*                                                                          */
+/****************************************************************************/
+ULONG MidiMsToTicks(SMFINFO *pInfo, ULONG ulMs)
+{
+    SMFTEMPO *t;
+    ULONG fps, tpf;
+
+    if (smpteDivision(pInfo, &fps, &tpf))
+        return (unsigned long long)ulMs * fps * tpf / 1000;
+
+    if (!(t = findTempo(pInfo, -1, ulMs)))
+        return (unsigned long long)ulMs * 1000 * pInfo->usDivision /
+               SMF_TEMPO_DEFAULT;
+
+    return t->ulTick + (unsigned long long)(ulMs - t->ulMs) * 1000 *
+                       pInfo->usDivision / t->ulTempo;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  MidiSilenceEnd                                         */
+/*                                                                          */
+/* DESCRIPTIVE NAME:  Query the end of a silence                            */
+/*                                                                          */
+/* FUNCTION:  Find the span without notes containing the time by binary     */
+/*            search.  A span after notes starts silent only after the      */
+/*            tail, while the release and the reverb decay.                 */
+/*                                                                          */
+/* PARAMETERS:                                                              */
+/*      SMFINFO *pInfo   -- information of MIDI file.                       */
+/*      ULONG    ulMs    -- ms.                                             */
+/*      ULONG    ulTail  -- ms to wait after the last note is released.     */
+/*                                                                          */
+/* EXIT CODES:  ms at which the silence ends, or 0 if not silent.           */
+/*                                                                          */
+/****************************************************************************/
+ULONG MidiSilenceEnd(SMFINFO *pInfo, ULONG ulMs, ULONG ulTail)
+{
+    LONG lo = 0;
+    LONG hi = (LONG)pInfo->ulSilences - 1;
+    SMFSILENCE *found = NULL;
+
+    while (lo <= hi)
+    {
+        LONG mid = (lo + hi) / 2;
+        SMFSILENCE *s = &pInfo->pSilences[mid];
+
+        if (s->ulStart <= ulMs)
+        {
+            found = s;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    if (!found || ulMs >= found->ulEnd ||
+        (found->ulStart && ulMs < found->ulStart + ulTail))
+        return 0;
+
+    return found->ulEnd;
+}
@@ -0,0 +1,871 @@
+/****************************************************************************
+**
+** smplmem.c
+**
+** Copyright (C) 2026 by KO Myung-Hun <komh@chollian.net>
+**
+** This file is part of K Soft Sequencer.
+**
+** $BEGIN_LICENSE$
+**
+** GNU Lesser General Public License Usage
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**
+** $END_LICENSE$
+**
+****************************************************************************/
+
+/*
+ * Memory-budgeted residency of SoundFont sample data
+ *
+ * fluidsynth v1.0.9 loads the whole smpl chunk into one block with malloc()
+ * and one plain fread(). It has neither file callbacks nor a sample cache,
+ * so fread() is overridden for the whole module like malloc() in malloc.c,
+ * and skips reading into a block of smplmemAlloc().
+ *
+ * If the chunk is larger than SFMEMLIMIT MiB, the block is only reserved.
+ * Pages are committed and read from the file on access in smplmemHandler(),
+ * and the least recently used chunks are decommitted with the clock
+ * algorithm when over the budget.
+ *
+ * smplmemHandler() should be registered on every thread touching sample
+ * data, that is, mciDriverEntry() and kaiCallback().
+ *
+ * Otherwise, sample data is loaded into named shared memory, so that the
+ * processes playing the same SoundFont share it. The name is made from the
+ * path, the size and the modified time of SoundFont. OS/2 frees the shared
+ * memory when the last process using it frees it.
+ *
+ * Loading into shared memory starts in smplmemExpect() with SFLOADTHREADS
+ * threads reading large blocks, while fluidsynth parses presets. Then
+ * smplmemAlloc() waits for them.
+ */
+
+#define INCL_DOS
+#define INCL_DOSEXCEPTIONS
+#include <os2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <io.h>
+#include <fcntl.h>
+
+#include <process.h>
+
+#include <sys/fmutex.h>
+#include <sys/stat.h>
+
+#include "mcdtemp.h"
+
+#define CHUNK_SIZE  ( 64 * 1024 )
+#define PAGE_SIZE   ( 4 * 1024 )
+#define MIN_CHUNKS  16
+
+#define LOAD_BLOCK_SIZE     ( 1024 * 1024 )
+#define LOAD_THREADS_MAX    8
+#define LOAD_STACK_SIZE     ( 64 * 1024 )
+
+#define SHM_DATA_OFFSET     64  /* offset of sample data in shared memory */
+
+/* states of a chunk */
+#define CHUNK_NOT_COMMITTED 0
+#define CHUNK_COMMITTED     1
+#define CHUNK_REFERENCED    2
+#define CHUNK_PINNED        3   /* the first chunk having a header */
+
+typedef struct EXPECTED
+{
+    struct EXPECTED *next;
+    TID     tid;
+    CHAR    szSf[CCHMAXPATH];
+    LONG    lPos;
+    ULONG   ulSize;
+    struct SHAREDBLOCK *s;  /* shared memory being loaded */
+} EXPECTED;
+
+typedef struct SMPLBLOCK
+{
+    struct SMPLBLOCK *next;
+    PBYTE   base;           /* reserved memory */
+    ULONG   ulSize;         /* size of memory */
+    ULONG   ulHeader;       /* size of a header before sample data */
+    int     fd;             /* SoundFont to reload from */
+    LONG    lPos;           /* offset of sample data in SoundFont */
+    ULONG   ulChunks;
+    PBYTE   state;          /* state of each chunk */
+} SMPLBLOCK;
+
+typedef struct SHAREDBLOCK
+{
+    struct SHAREDBLOCK *next;
+    PBYTE   shm;            /* named shared memory */
+    PBYTE   base;           /* memory returned to malloc() */
+    ULONG   ulSize;         /* size of memory */
+    ULONG   ulKey;          /* hash of SoundFont */
+    ULONG   ulRefs;         /* references in this process */
+    HMTX    hmtx;           /* held while loading */
+    TID     tidLoader;      /* thread holding hmtx */
+    TID     tidWorkers[LOAD_THREADS_MAX];
+    ULONG   ulWorkers;
+    CHAR    szSf[CCHMAXPATH];
+    LONG    lPos;           /* offset of sample data in SoundFont */
+    ULONG   ulSmplSize;     /* size of sample data */
+    ULONG   ulBlocks;       /* in LOAD_BLOCK_SIZE */
+    ULONG volatile ulNextBlock;
+    BOOL volatile fError;
+} SHAREDBLOCK;
+
+/* header of named shared memory */
+typedef struct SHMHEADER
+{
+    volatile ULONG fLoaded;
+    ULONG   ulReserved[3];
+} SHMHEADER;
+
+static _fmutex lock = _FMUTEX_INITIALIZER;
+
+static EXPECTED *expected = NULL;
+static SMPLBLOCK *blocks = NULL;
+
+/* for shared memory */
+static _fmutex sharedLock = _FMUTEX_INITIALIZER;
+
+static SHAREDBLOCK *shared = NULL;
+
+static ULONG ulBudget = 0;      /* in chunks */
+static ULONG ulCommitted = 0;   /* in chunks */
+
+/* clock hand */
+static SMPLBLOCK *handBlock = NULL;
+static ULONG handChunk = 0;
+
+static TID queryTid(VOID)
+{
+    PTIB ptib;
+
+    DosGetInfoBlocks(&ptib, NULL);
+
+    return ptib->tib_ptib2->tib2_ultid;
+}
+
+static ULONG chunkLen(SMPLBLOCK *b, ULONG chunk)
+{
+    ULONG len = b->ulSize - chunk * CHUNK_SIZE;
+
+    if (len > CHUNK_SIZE)
+        len = CHUNK_SIZE;
+
+    return (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+/* commit a chunk, and read sample data of it */
+static BOOL loadChunk(SMPLBLOCK *b, ULONG chunk)
+{
+    PBYTE addr = b->base + chunk * CHUNK_SIZE;
+    ULONG len = chunkLen(b, chunk);
+    LONG  offset = chunk * CHUNK_SIZE - b->ulHeader;
+
+    if (DosSetMem(addr, len, PAG_COMMIT | PAG_READ | PAG_WRITE))
+        return FALSE;
+
+    if (offset < 0)
+    {
+        /* skip a header */
+        addr -= offset;
+        len += offset;
+        offset = 0;
+    }
+
+    if (offset + len > b->ulSize - b->ulHeader)
+        len = b->ulSize - b->ulHeader - offset;
+
+    if (lseek(b->fd, b->lPos + offset, SEEK_SET) == -1 ||
+        read(b->fd, addr, len) != len)
+        LOG_MSG(2, "cannot read sample data at %ld", b->lPos + offset);
+
+    ulCommitted++;
+
+    return TRUE;
+}
+
+/* decommit the least recently used chunk */
+static BOOL evictChunk(VOID)
+{
+    ULONG ulTotal = 0;
+
+    for (SMPLBLOCK *b = blocks; b; b = b->next)
+        ulTotal += b->ulChunks;
+
+    /* at most two rounds, the first one may just clear referenced states */
+    for (ULONG i = 0; i < ulTotal * 2; i++)
+    {
+        if (!handBlock || ++handChunk >= handBlock->ulChunks)
+        {
+            handBlock = handBlock && handBlock->next ? handBlock->next : blocks;
+            handChunk = 0;
+        }
+
+        PBYTE state = &handBlock->state[handChunk];
+        PBYTE addr = handBlock->base + handChunk * CHUNK_SIZE;
+        ULONG len = chunkLen(handBlock, handChunk);
+
+        if (*state == CHUNK_REFERENCED)
+        {
+            /* give a second chance, and watch accesses with guard pages */
+            *state = CHUNK_COMMITTED;
+            DosSetMem(addr, len, PAG_READ | PAG_WRITE | PAG_GUARD);
+        }
+        else if (*state == CHUNK_COMMITTED)
+        {
+            *state = CHUNK_NOT_COMMITTED;
+            DosSetMem(addr, len, PAG_DECOMMIT);
+            ulCommitted--;
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static SMPLBLOCK *findBlock(PVOID p)
+{
+    for (SMPLBLOCK *b = blocks; b; b = b->next)
+    {
+        if ((PBYTE)p >= b->base && (PBYTE)p < b->base + b->ulSize)
+            return b;
+    }
+
+    return NULL;
+}
+
+static SHAREDBLOCK *findShared(PVOID p)
+{
+    for (SHAREDBLOCK *s = shared; s; s = s->next)
+    {
+        if ((PBYTE)p >= s->base && (PBYTE)p < s->base + s->ulSize)
+            return s;
+    }
+
+    return NULL;
+}
+
+/* read blocks of sample data into shared memory */
+static void loadWorker(void *arg)
+{
+    SHAREDBLOCK *s = arg;
+    PBYTE data = s->shm + SHM_DATA_OFFSET;
+    ULONG block;
+    int fd;
+
+    if ((fd = open(s->szSf, O_RDONLY | O_BINARY)) == -1)
+    {
+        s->fError = TRUE;
+
+        return;
+    }
+
+    while (!s->fError &&
+           (block = __sync_fetch_and_add(&s->ulNextBlock, 1)) < s->ulBlocks)
+    {
+        ULONG offset = block * LOAD_BLOCK_SIZE;
+        ULONG len = s->ulSmplSize - offset;
+
+        if (len > LOAD_BLOCK_SIZE)
+            len = LOAD_BLOCK_SIZE;
+
+        if (lseek(fd, s->lPos + offset, SEEK_SET) == -1 ||
+            read(fd, data + offset, len) != len)
+            s->fError = TRUE;
+    }
+
+    close(fd);
+}
+
+/* add a reference to shared memory used by this process */
+static SHAREDBLOCK *attachShared(ULONG ulKey, ULONG ulSize)
+{
+    SHAREDBLOCK *s;
+
+    _fmutex_request(&sharedLock, 0);
+
+    for (s = shared; s; s = s->next)
+    {
+        if (s->ulKey == ulKey && s->ulSmplSize == ulSize)
+        {
+            s->ulRefs++;
+            break;
+        }
+    }
+
+    _fmutex_release(&sharedLock);
+
+    return s;
+}
+
+/*
+ * start loading sample data into named shared memory, or attach to it.
+ * sharedLock should not be owned, as this may wait for another process.
+ */
+static SHAREDBLOCK *prepareShared(PCSZ pszSf, LONG lPos, ULONG ulSize,
+                                  ULONG ulThreads)
+{
+    SHAREDBLOCK *s;
+    struct stat st;
+    CHAR  szName[CCHMAXPATH];
+    ULONG ulKey = 2166136261UL;     /* FNV-1a of path, size and mtime */
+    ULONG ulTotal = SHM_DATA_OFFSET + ulSize;
+    ULONG cb, fl;
+    APIRET rc;
+
+    if (stat(pszSf, &st) == -1)
+        return NULL;
+
+    for (PCSZ p = pszSf; *p; p++)
+        ulKey = (ulKey ^ (BYTE)toupper(*p)) * 16777619UL;
+    ulKey = (ulKey ^ st.st_size) * 16777619UL;
+    ulKey = (ulKey ^ st.st_mtime) * 16777619UL;
+    ulKey = (ulKey ^ lPos) * 16777619UL;
+
+    /* already used by this process ? */
+    if ((s = attachShared(ulKey, ulSize)))
+        return s;
+
+    if (!(s = calloc(1, sizeof(*s))))
+        return NULL;
+
+    /* serialize loading among processes */
+    snprintf(szName, sizeof(szName),
+             "\\SEM32\\KSOFTSEQ\\%08lX.SMP", ulKey);
+    rc = DosCreateMutexSem(szName, &s->hmtx, 0, FALSE);
+    if (rc == ERROR_DUPLICATE_NAME)
+        rc = DosOpenMutexSem(szName, &s->hmtx);
+
+    if (!rc)
+        rc = DosRequestMutexSem(s->hmtx, SEM_INDEFINITE_WAIT);
+
+    /* the owner died while loading, then load again */
+    if (rc == ERROR_SEM_OWNER_DIED)
+        rc = NO_ERROR;
+
+    /* another thread of this process may have loaded it meanwhile */
+    SHAREDBLOCK *other;
+
+    if (!rc && (other = attachShared(ulKey, ulSize)))
+    {
+        DosReleaseMutexSem(s->hmtx);
+        DosCloseMutexSem(s->hmtx);
+        free(s);
+
+        return other;
+    }
+
+    snprintf(szName, sizeof(szName),
+             "\\SHAREMEM\\KSOFTSEQ\\%08lX.SMP", ulKey);
+    if (!rc &&
+        DosGetNamedSharedMem((PPVOID)&s->shm, szName, PAG_READ | PAG_WRITE) &&
+        DosAllocSharedMem((PPVOID)&s->shm, szName, ulTotal,
+                          PAG_COMMIT | PAG_READ | PAG_WRITE | OBJ_ANY))
+        s->shm = NULL;
+
+    cb = ulTotal;
+    if (s->shm && (DosQueryMem(s->shm, &cb, &fl) || cb < ulTotal))
+    {
+        /* hash collision */
+        DosFreeMem(s->shm);
+        s->shm = NULL;
+    }
+
+    LOG_MSG(2, "%s for sample data of %lu bytes = %p",
+            szName, ulSize, s->shm);
+
+    if (!s->shm)
+    {
+        if (s->hmtx)
+        {
+            if (!rc)
+                DosReleaseMutexSem(s->hmtx);
+            DosCloseMutexSem(s->hmtx);
+        }
+        free(s);
+
+        return NULL;
+    }
+
+    s->ulKey = ulKey;
+    s->ulRefs = 1;
+    snprintf(s->szSf, sizeof(s->szSf), "%s", pszSf);
+    s->lPos = lPos;
+    s->ulSmplSize = ulSize;
+    s->ulBlocks = (ulSize + LOAD_BLOCK_SIZE - 1) / LOAD_BLOCK_SIZE;
+
+    BOOL fLoaded = ((SHMHEADER *)s->shm)->fLoaded;
+
+    if (!fLoaded)
+    {
+        /* keep hmtx until loaded */
+        s->tidLoader = queryTid();
+
+        if (ulThreads > LOAD_THREADS_MAX)
+            ulThreads = LOAD_THREADS_MAX;
+
+        for (ULONG i = 0; i < ulThreads; i++)
+        {
+            int tid = _beginthread(loadWorker, NULL, LOAD_STACK_SIZE, s);
+
+            if (tid != -1)
+                s->tidWorkers[s->ulWorkers++] = tid;
+        }
+
+        LOG_MSG(2, "loading with %lu threads", s->ulWorkers);
+    }
+
+    _fmutex_request(&sharedLock, 0);
+
+    s->next = shared;
+    shared = s;
+
+    _fmutex_release(&sharedLock);
+
+    /* keep hmtx until listed, so that other threads find this */
+    if (fLoaded)
+        DosReleaseMutexSem(s->hmtx);
+
+    return s;
+}
+
+/* wait for loading into shared memory, return TRUE if loaded */
+static BOOL finishShared(SHAREDBLOCK *s)
+{
+    SHMHEADER *h = (SHMHEADER *)s->shm;
+
+    if (s->tidLoader == queryTid())
+    {
+        /* load by itself if no thread was started */
+        if (!s->ulWorkers)
+            loadWorker(s);
+
+        for (ULONG i = 0; i < s->ulWorkers; i++)
+            DosWaitThread(&s->tidWorkers[i], DCWW_WAIT);
+
+        s->ulWorkers = 0;
+
+        if (!s->fError)
+            h->fLoaded = TRUE;
+
+        s->tidLoader = 0;
+        DosReleaseMutexSem(s->hmtx);
+    }
+    else if (s->tidLoader)
+    {
+        /* being loaded by another thread of this process */
+        DosRequestMutexSem(s->hmtx, SEM_INDEFINITE_WAIT);
+        DosReleaseMutexSem(s->hmtx);
+    }
+
+    return h->fLoaded;
+}
+
+static VOID releaseShared(SHAREDBLOCK *s)
+{
+    _fmutex_request(&sharedLock, 0);
+
+    if (--s->ulRefs == 0)
+    {
+        for (SHAREDBLOCK **ps = &shared; *ps; ps = &(*ps)->next)
+        {
+            if (*ps == s)
+            {
+                *ps = s->next;
+                break;
+            }
+        }
+
+        DosFreeMem(s->shm);
+        DosCloseMutexSem(s->hmtx);
+        free(s);
+    }
+
+    _fmutex_release(&sharedLock);
+}
+
+size_t _std_fread(void *, size_t, size_t, FILE *);
+
+/*
+ * fread() of fluidsynth into a reserved block is done on access later, and
+ * the one into a shared block is done by the loading threads.
+ */
+size_t fread(void *buf, size_t size, size_t count, FILE *fp)
+{
+    SMPLBLOCK *b;
+    SHAREDBLOCK *s = NULL;
+    ULONG ulLeft = 0;
+
+    _fmutex_request(&lock, 0);
+
+    if ((b = findBlock(buf)))
+        ulLeft = b->ulSize - ((PBYTE)buf - b->base);
+
+    _fmutex_release(&lock);
+
+    if (!b)
+    {
+        _fmutex_request(&sharedLock, 0);
+
+        if ((s = findShared(buf)))
+            ulLeft = s->ulSize - ((PBYTE)buf - s->base);
+
+        _fmutex_release(&sharedLock);
+    }
+
+    if ((b || s) && size * count <= ulLeft)
+        return fseek(fp, size * count, SEEK_CUR) ? 0 : count;
+
+    return _std_fread(buf, size, count, fp);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  smplmemExpect                                          */
+/*                                                                          */
+/* FUNCTION:  Tell that the current thread is about to load SoundFont.      */
+/*            Its sample data will be allocated by smplmemAlloc() with the  */
+/*            limit of SFMEMLIMIT MiB if larger than it, or in shared       */
+/*            memory unless SFSHARE=0.                                      */
+/*                                                                          */
+/****************************************************************************/
+VOID smplmemExpect(PINSTANCE pInstance, PCSZ pszSf)
+{
+    ULONG ulDepth = pInstance ? pInstance->ulDepth : 2;
+    ULONG ulLimit = GetDevParamULong(pInstance, "SFMEMLIMIT", 0);
+    BOOL  fShared = GetDevParamULong(pInstance, "SFSHARE", 1);
+    ULONG ulThreads = 1;
+    LONG  lPos;
+    ULONG ulSize;
+    EXPECTED *e;
+
+    if (!QuerySampleChunk(pszSf, &lPos, &ulSize))
+        return;
+
+    if (ulLimit && ulSize > ulLimit * 1024 * 1024)
+        fShared = FALSE;
+    else if (!fShared)
+        return;
+
+    if (!(e = malloc(sizeof(*e))))
+        return;
+
+    if (fShared)
+        LOG_MSG(ulDepth, "share sample memory of %lu bytes", ulSize);
+    else
+        LOG_MSG(ulDepth, "limit sample memory of %lu bytes to %lu MiB",
+                ulSize, ulLimit);
+
+    e->tid = queryTid();
+    snprintf(e->szSf, sizeof(e->szSf), "%s", pszSf);
+    e->lPos = lPos;
+    e->ulSize = ulSize;
+    e->s = NULL;
+
+    if (fShared)
+    {
+        DosQuerySysInfo(QSV_NUMPROCESSORS, QSV_NUMPROCESSORS,
+                        &ulThreads, sizeof(ulThreads));
+        ulThreads = GetDevParamULong(pInstance, "SFLOADTHREADS", ulThreads);
+
+        e->s = prepareShared(pszSf, lPos, ulSize, ulThreads);
+
+        if (!e->s)
+        {
+            free(e);
+
+            return;
+        }
+    }
+
+    _fmutex_request(&lock, 0);
+
+    if (!fShared)
+    {
+        ulBudget = ulLimit * (1024 * 1024 / CHUNK_SIZE);
+        if (ulBudget < MIN_CHUNKS)
+            ulBudget = MIN_CHUNKS;
+    }
+
+    e->next = expected;
+    expected = e;
+
+    _fmutex_release(&lock);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  smplmemExpectDone                                      */
+/*                                                                          */
+/* FUNCTION:  Tell that the current thread has finished loading SoundFont.  */
+/*                                                                          */
+/****************************************************************************/
+VOID smplmemExpectDone(VOID)
+{
+    TID tid = queryTid();
+    EXPECTED *done = NULL;
+
+    _fmutex_request(&lock, 0);
+
+    for (EXPECTED **pe = &expected; *pe;)
+    {
+        EXPECTED *e = *pe;
+
+        if (e->tid == tid)
+        {
+            *pe = e->next;
+            e->next = done;
+            done = e;
+        }
+        else
+            pe = &e->next;
+    }
+
+    _fmutex_release(&lock);
+
+    while (done)
+    {
+        EXPECTED *e = done;
+
+        done = e->next;
+
+        if (e->s)
+        {
+            /* not allocated, stop loading */
+            if (e->s->tidLoader == tid)
+                e->s->fError = TRUE;
+
+            finishShared(e->s);
+            releaseShared(e->s);
+        }
+
+        free(e);
+    }
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  smplmemAlloc                                           */
+/*                                                                          */
+/* FUNCTION:  Reserve a block for the expected sample data of ulSize bytes  */
+/*            following ulHeader bytes, or load it into shared memory.      */
+/*            Return NULL if not expected.                                  */
+/*                                                                          */
+/****************************************************************************/
+PVOID smplmemAlloc(ULONG ulHeader, ULONG ulSize)
+{
+    TID tid = queryTid();
+    SMPLBLOCK *b = NULL;
+    EXPECTED **pe;
+
+    _fmutex_request(&lock, 0);
+
+    for (pe = &expected; *pe; pe = &(*pe)->next)
+    {
+        if ((*pe)->tid == tid && (*pe)->ulSize == ulSize)
+            break;
+    }
+
+    if (*pe && (*pe)->s)
+    {
+        EXPECTED *e = *pe;
+        SHAREDBLOCK *s = e->s;
+
+        *pe = e->next;
+        free(e);
+
+        _fmutex_release(&lock);
+
+        if (ulHeader > SHM_DATA_OFFSET - sizeof(SHMHEADER) ||
+            !finishShared(s))
+        {
+            releaseShared(s);
+
+            return NULL;
+        }
+
+        s->base = s->shm + SHM_DATA_OFFSET - ulHeader;
+        s->ulSize = ulHeader + ulSize;
+
+        return s->base;
+    }
+
+    if (*pe && (b = calloc(1, sizeof(*b))))
+    {
+        EXPECTED *e = *pe;
+
+        b->ulHeader = ulHeader;
+        b->ulSize = ulHeader + ulSize;
+        b->lPos = e->lPos;
+        b->ulChunks = (b->ulSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        b->fd = open(e->szSf, O_RDONLY | O_BINARY);
+
+        if (b->fd == -1 || !(b->state = calloc(b->ulChunks, 1)) ||
+            DosAllocMem((PPVOID)&b->base, b->ulSize,
+                        PAG_READ | PAG_WRITE | OBJ_ANY))
+            b->base = NULL;
+        else if (!loadChunk(b, 0))
+        {
+            DosFreeMem(b->base);
+            b->base = NULL;
+        }
+
+        if (b->base)
+        {
+            b->state[0] = CHUNK_PINNED;
+            b->next = blocks;
+            blocks = b;
+
+            *pe = e->next;
+            free(e);
+        }
+        else
+        {
+            if (b->fd != -1)
+                close(b->fd);
+            free(b->state);
+            free(b);
+            b = NULL;
+        }
+    }
+
+    _fmutex_release(&lock);
+
+    LOG_MSG(2, "reserved %lu bytes for sample data = %p",
+            ulSize, b ? b->base : NULL);
+
+    return b ? b->base : NULL;
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  smplmemFree                                            */
+/*                                                                          */
+/* FUNCTION:  Free a block allocated by smplmemAlloc().                     */
+/*                                                                          */
+/****************************************************************************/
+VOID smplmemFree(PVOID p)
+{
+    SHAREDBLOCK *s;
+
+    _fmutex_request(&sharedLock, 0);
+
+    for (s = shared; s; s = s->next)
+    {
+        if (s->base == p)
+            break;
+    }
+
+    _fmutex_release(&sharedLock);
+
+    if (s)
+    {
+        releaseShared(s);
+
+        return;
+    }
+
+    _fmutex_request(&lock, 0);
+
+    for (SMPLBLOCK **pb = &blocks; *pb; pb = &(*pb)->next)
+    {
+        SMPLBLOCK *b = *pb;
+
+        if (b->base == p)
+        {
+            for (ULONG i = 0; i < b->ulChunks; i++)
+            {
+                if (b->state[i] != CHUNK_NOT_COMMITTED)
+                    ulCommitted--;
+            }
+
+            if (handBlock == b)
+                handBlock = NULL;
+
+            *pb = b->next;
+
+            DosFreeMem(b->base);
+            close(b->fd);
+            free(b->state);
+            free(b);
+
+            break;
+        }
+    }
+
+    _fmutex_release(&lock);
+}
+
+/****************************************************************************/
+/*                                                                          */
+/* SUBROUTINE NAME:  smplmemHandler                                         */
+/*                                                                          */
+/* FUNCTION:  Exception handler committing sample data on access.           */
+/*                                                                          */
+/****************************************************************************/
+ULONG APIENTRY smplmemHandler(PEXCEPTIONREPORTRECORD pReport,
+                              PEXCEPTIONREGISTRATIONRECORD pRegRec,
+                              PCONTEXTRECORD pContext,
+                              PVOID pDispatcherContext)
+{
+    ULONG rc = XCPT_CONTINUE_SEARCH;
+
+    if (pReport->fHandlerFlags & (EH_UNWINDING | EH_EXIT_UNWIND | EH_NESTED_CALL))
+        return rc;
+
+    if (pReport->ExceptionNum != XCPT_ACCESS_VIOLATION &&
+        pReport->ExceptionNum != XCPT_GUARD_PAGE_VIOLATION)
+        return rc;
+
+    PVOID p = (PVOID)pReport->ExceptionInfo[1];
+    SMPLBLOCK *b;
+
+    _fmutex_request(&lock, 0);
+
+    if ((b = findBlock(p)))
+    {
+        ULONG chunk = ((PBYTE)p - b->base) / CHUNK_SIZE;
+        PBYTE state = &b->state[chunk];
+
+        if (pReport->ExceptionNum == XCPT_GUARD_PAGE_VIOLATION)
+        {
+            /* accessed again, remove guard pages of the other pages */
+            if (*state == CHUNK_COMMITTED)
+                *state = CHUNK_REFERENCED;
+
+            DosSetMem(b->base + chunk * CHUNK_SIZE, chunkLen(b, chunk),
+                      PAG_READ | PAG_WRITE);
+
+            rc = XCPT_CONTINUE_EXECUTION;
+        }
+        else if (*state == CHUNK_NOT_COMMITTED)
+        {
+            while (ulCommitted >= ulBudget && evictChunk())
+                /* nothing */;
+
+            if (loadChunk(b, chunk))
+            {
+                *state = CHUNK_REFERENCED;
+
+                rc = XCPT_CONTINUE_EXECUTION;
+            }
+        }
+    }
+
+    _fmutex_release(&lock);
+
+    return rc;
+}